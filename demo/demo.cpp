@@ -55,6 +55,8 @@ size_t drag_edge_shape;
 size_t drag_vertex;
 mat3 drag_T;
 bool u_constrain;
+// Is it a tiling vertex (drag_vertex) rather than an edge vertex?
+bool drag_tiling_vertex = false;
 
 // More UI stuff: which features to enable / disasble
 bool visualize_fill = false;
@@ -361,9 +363,11 @@ static double distToSeg( const dvec2& P, const dvec2& A, const dvec2& B )
 
 // Click on an editable vertex to start moving it.  Shift-click to
 // delete a vertex.  Click on an edge to generate a vertex there.
+// Click on a tiling vertex to drag it, changing the parameters.
 static bool hitTestEditor( const dvec2& mpt, bool del = false )
 {
 	dragging = false;
+	drag_tiling_vertex = false;
 
 	if( !show_editor ) {
 		return false;
@@ -376,6 +380,21 @@ static bool hitTestEditor( const dvec2& mpt, bool del = false )
 	if( (mpt.y < editor_y) || (mpt.y > (editor_y + editor_height)) ) {
 		return false;
 	}
+
+	if( !del ) {
+		for( U8 idx = 0; idx < tiling.numVertices(); ++idx ) {
+			dvec2 P = 
+				editor_transform * dvec3( tiling.getVertex( idx ), 1.0 );
+			if( distance2( P, mpt ) < 49 ) {
+				dragging = true;
+				drag_tiling_vertex = true;
+				drag_vertex = idx;
+				drag_T = inverse( editor_transform );
+
+				return true;
+			}
+		}
+	}
 		
 	for( auto i : tiling.parts() ) {
 		EdgeShape shp = i->getShape();
@@ -494,7 +513,7 @@ void drawEditor( NVGcontext *vg )
 
 	nvgFillColor( vg, nvgRGB( 128, 128, 128 ) );
 
-	// Draw the tiling vertices, which are not directly editable.
+	// Draw the tiling vertices, which drag the parameters along with them.
 	for( auto v : tiling.vertices() ) {
 		dvec2 pt = editor_transform * dvec3( v, 1.0 );
 		nvgBeginPath( vg );
@@ -549,7 +568,14 @@ void drawEditor( NVGcontext *vg )
 
 static void mouseMotion( GLFWwindow* window, double xpos, double ypos )
 {
-	if( dragging ) {
+	if( dragging && drag_tiling_vertex ) {
+		// The editor transform stays put until the drag is over, so that
+		// the vertex tracks the mouse.
+		dvec2 npt = drag_T * dvec3( xpos, ypos, 1.0 );
+		tiling.fitVertex( U8( drag_vertex ), npt, params );
+		tiling.setParameters( params );
+		cacheTileShape();
+	} else if( dragging ) {
 		dvec2 npt = drag_T * dvec3( xpos, ypos, 1.0 );
 		if( u_constrain ) {
 			npt.x = 1.0;
@@ -569,6 +595,9 @@ static void mouse( GLFWwindow *window, int button, int action, int mods )
 		glfwGetCursorPos( window, &xpos, &ypos );
 		hitTestEditor( dvec2( xpos, ypos ), mods & GLFW_MOD_SHIFT );
 	} else if( action == GLFW_RELEASE ) {
+		if( dragging && drag_tiling_vertex ) {
+			calcEditorTransform();
+		}
 		dragging = false;
 	}
   }
@@ -1,20 +1,260 @@
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
-
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_access.hpp>
 
 #include "tiling.hpp"
+#include "tiling_static.hpp"
 
 using namespace std;
 using namespace csk;
 
-// Suck in all the data arrays instead of trying to declare them
-// inline.
 namespace csk {
-#include "tiling_arraydecl.inc"
+const U8 tiling_types[81] = {
+	1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 61, 62, 64, 66, 67, 68, 69, 71, 72, 73, 74, 76, 77, 78, 79, 81, 82, 83, 84, 85, 86, 88, 90, 91, 93
+};
+
+// The tables for a given type are scattered across tiling_arraydecl.inc,
+// and many are shared between types.  For speed, each type gets its own
+// copy of everything reset() and recompute() read, packed contiguously
+// in the order they read it: default parameters, vertex coefficients, 
+// aspect coefficients, translation coefficients and colouring, followed
+// by the pseudo-inverse of the vertex coefficients for fitVertices().  
+// Blocks and the sections within them start on 64-byte boundaries, with
+// zero padding, so each section can be streamed through in whole cache 
+// lines and vector registers.  Which parameters each product depends on
+// is worked out once here too.
+
+static const size_t packed_align = 8; // In doubles.
+
+static constexpr size_t padPacked( size_t n )
+{
+	return (n + packed_align - 1) / packed_align * packed_align;
+}
+
+static constexpr size_t packedSize( const TilingTypeData& ttd )
+{
+	return padPacked( ttd.num_params )
+		+ padPacked( 2 * ttd.num_vertices * (ttd.num_params + 1u) )
+		+ padPacked( 6 * ttd.num_aspects * (ttd.num_params + 1u) )
+		+ padPacked( 4 * (ttd.num_params + 1u) )
+		+ padPacked( (19 + sizeof( double ) - 1) / sizeof( double ) )
+		+ padPacked( 2 * ttd.num_vertices * ttd.num_params );
+}
+
+static constexpr size_t packedTotal( size_t from = 0 )
+{
+	return (from == 94) ? 0 : ( 
+		(tiling_type_data[from].num_vertices > 0 
+			? packedSize( tiling_type_data[from] ) : 0)
+		+ packedTotal( from + 1 ) );
+}
+
+struct PackedType {
+	const double *default_params;
+	const double *tiling_vertex_coeffs;
+	const double *aspect_xform_coeffs;
+	const double *translation_vector_coeffs;
+	const U8 *colouring;
+	const double *vertex_pinv;
+	U8 vertex_params;
+	U8 lattice_params;
+};
+
+struct PackedTables {
+	PackedTables();
+
+	alignas( 64 ) double data[packedTotal()];
+	PackedType types[94];
 };
 
+static const double *packSection( double *&dest, const double *src, size_t n )
+{
+	double *ret = dest;
+	std::copy( src, src + n, dest );
+	std::fill( dest + n, dest + padPacked( n ), 0.0 );
+	dest += padPacked( n );
+	return ret;
+}
+
+// Write the Moore-Penrose pseudo-inverse of the rows x np matrix held in
+// the first np columns of coeffs (whose rows have an extra, affine, 
+// entry) to out, as np rows of rows entries.  With at most six 
+// parameters, it's easiest to go through the Gram matrix G: diagonalize
+// it by Jacobi rotations, invert the eigenvalues that aren't negligible,
+// and multiply the result by the transpose.
+static void pseudoInverse( 
+	const double *coeffs, size_t rows, size_t np, double *out )
+{
+	size_t stride = np + 1;
+	double G[6][6];
+	double V[6][6];
+	for( size_t i = 0; i < np; ++i ) {
+		for( size_t j = 0; j < np; ++j ) {
+			double total = 0.0;
+			for( size_t r = 0; r < rows; ++r ) {
+				total += coeffs[r*stride + i] * coeffs[r*stride + j];
+			}
+			G[i][j] = total;
+			V[i][j] = (i == j) ? 1.0 : 0.0;
+		}
+	}
+
+	for( int sweep = 0; sweep < 50; ++sweep ) {
+		double off = 0.0;
+		for( size_t i = 0; i < np; ++i ) {
+			for( size_t j = i + 1; j < np; ++j ) {
+				off += G[i][j] * G[i][j];
+			}
+		}
+		if( off < 1e-30 ) {
+			break;
+		}
+
+		for( size_t p = 0; p < np; ++p ) {
+			for( size_t q = p + 1; q < np; ++q ) {
+				if( G[p][q] == 0.0 ) {
+					continue;
+				}
+				double theta = (G[q][q] - G[p][p]) / (2.0 * G[p][q]);
+				double t = ((theta >= 0.0) ? 1.0 : -1.0) 
+					/ (std::fabs( theta ) + std::sqrt( theta*theta + 1.0 ));
+				double c = 1.0 / std::sqrt( t*t + 1.0 );
+				double sn = t * c;
+				for( size_t k = 0; k < np; ++k ) {
+					double gkp = G[k][p];
+					double gkq = G[k][q];
+					G[k][p] = c*gkp - sn*gkq;
+					G[k][q] = sn*gkp + c*gkq;
+				}
+				for( size_t k = 0; k < np; ++k ) {
+					double gpk = G[p][k];
+					double gqk = G[q][k];
+					G[p][k] = c*gpk - sn*gqk;
+					G[q][k] = sn*gpk + c*gqk;
+				}
+				for( size_t k = 0; k < np; ++k ) {
+					double vkp = V[k][p];
+					double vkq = V[k][q];
+					V[k][p] = c*vkp - sn*vkq;
+					V[k][q] = sn*vkp + c*vkq;
+				}
+			}
+		}
+	}
+
+	double biggest = 0.0;
+	for( size_t i = 0; i < np; ++i ) {
+		biggest = std::max( biggest, std::fabs( G[i][i] ) );
+	}
+	double inv[6];
+	for( size_t i = 0; i < np; ++i ) {
+		inv[i] = (std::fabs( G[i][i] ) > 1e-12 * biggest) 
+			? (1.0 / G[i][i]) : 0.0;
+	}
+
+	// out = V diag(inv) V^T C^T.
+	for( size_t i = 0; i < np; ++i ) {
+		double Gplus[6];
+		for( size_t j = 0; j < np; ++j ) {
+			double total = 0.0;
+			for( size_t e = 0; e < np; ++e ) {
+				total += V[i][e] * inv[e] * V[j][e];
+			}
+			Gplus[j] = total;
+		}
+		for( size_t r = 0; r < rows; ++r ) {
+			double total = 0.0;
+			for( size_t j = 0; j < np; ++j ) {
+				total += Gplus[j] * coeffs[r*stride + j];
+			}
+			out[i*rows + r] = total;
+		}
+	}
+}
+
+static U8 paramsUsed( const double *coeffs, size_t rows, size_t np )
+{
+	U8 ret = 0;
+	for( size_t k = 0; k < np; ++k ) {
+		for( size_t row = 0; row < rows; ++row ) {
+			if( coeffs[row*(np+1) + k] != 0.0 ) {
+				ret |= U8( 1 << k );
+			}
+		}
+	}
+	return ret;
+}
+
+PackedTables::PackedTables()
+{
+	double *dest = data;
+	for( size_t idx = 0; idx < 94; ++idx ) {
+		const TilingTypeData& ttd = tiling_type_data[idx];
+		PackedType& pt = types[idx];
+		if( ttd.num_vertices == 0 ) {
+			pt = PackedType();
+			continue;
+		}
+
+		size_t np = ttd.num_params;
+		size_t stride = np + 1;
+		size_t nvr = 2 * size_t( ttd.num_vertices );
+		size_t nar = 6 * size_t( ttd.num_aspects );
+
+		pt.default_params = packSection( dest, ttd.default_params, np );
+		pt.tiling_vertex_coeffs = 
+			packSection( dest, ttd.tiling_vertex_coeffs, nvr * stride );
+		pt.aspect_xform_coeffs = 
+			packSection( dest, ttd.aspect_xform_coeffs, nar * stride );
+		pt.translation_vector_coeffs = 
+			packSection( dest, ttd.translation_vector_coeffs, 4 * stride );
+
+		U8 *col = reinterpret_cast<U8*>( dest );
+		std::fill( col, col + padPacked( 3 ) * sizeof( double ), U8( 0 ) );
+		std::copy( ttd.colouring, ttd.colouring + 19, col );
+		pt.colouring = col;
+		dest += padPacked( 3 );
+
+		pseudoInverse( pt.tiling_vertex_coeffs, nvr, np, dest );
+		std::fill( dest + nvr*np, dest + padPacked( nvr*np ), 0.0 );
+		pt.vertex_pinv = dest;
+		dest += padPacked( nvr*np );
+
+		pt.vertex_params = paramsUsed( pt.tiling_vertex_coeffs, nvr, np );
+		pt.lattice_params = 
+			paramsUsed( pt.aspect_xform_coeffs, nar, np )
+			| paramsUsed( pt.translation_vector_coeffs, 4, np );
+	}
+}
+
+static const PackedTables& packedTables()
+{
+	static const PackedTables tables;
+	return tables;
+}
+
 IsohedralTiling::IsohedralTiling( TilingType ihtype )
+	: geometry_version( 0 )
+	, lattice_version( 0 )
 {
 	reset( ihtype );
 }
@@ -23,17 +263,35 @@ void IsohedralTiling::reset( TilingType ihtype )
 {
 	tiling_type = ihtype;
 	ttd = &tiling_type_data[ ihtype ];
+	const PackedType& pt = packedTables().types[ ihtype ];
 
 	num_params = ttd->num_params;
 	edge_shape_ids = ttd->edge_shape_ids;
 	edge_shapes = ttd->edge_shapes;
 	edge_shape_orientations = ttd->edge_orientations;
-	aspect_xform_coefficients = ttd->aspect_xform_coeffs;
-	translation_vector_coefficients = ttd->translation_vector_coeffs;
-	tiling_vertex_coefficients = ttd->tiling_vertex_coeffs;
-	colouring = ttd->colouring;
+	aspect_xform_coefficients = pt.aspect_xform_coeffs;
+	translation_vector_coefficients = pt.translation_vector_coeffs;
+	tiling_vertex_coefficients = pt.tiling_vertex_coeffs;
+	colouring = pt.colouring;
+	vertex_pinv = pt.vertex_pinv;
+
+	// Reversals depend only on the type.
+	U8 ntv = numVertices();
+	for( U8 idx = 0; idx < ntv; ++idx ) {
+		reversals[idx] = (edge_shape_orientations[2*idx] 
+			!= edge_shape_orientations[2*idx+1]);
+	}
 
-	setParameters( ttd->default_params );
+	vertex_params = pt.vertex_params;
+	lattice_params = pt.lattice_params;
+
+	std::copy( pt.default_params, 
+		pt.default_params + num_params, parameters );
+	num_updates = 0;
+	stale = STALE_ALL;
+	++geometry_version;
+	++lattice_version;
+	recompute();
 }
 
 IsohedralTiling::~IsohedralTiling()
@@ -51,8 +309,9 @@ U8 IsohedralTiling::numParameters() const
 
 void IsohedralTiling::setParameters( const double *params )
 {
-	std::copy( params, params + num_params, parameters );
-	recompute();
+	if( assignParameters( params ) ) {
+		recompute();
+	}
 }
 
 void IsohedralTiling::getParameters( double *params ) const
@@ -60,6 +319,137 @@ void IsohedralTiling::getParameters( double *params ) const
 	std::copy( parameters, parameters + num_params, params );
 }
 
+void IsohedralTiling::setParameter( U8 idx, double value )
+{
+	double delta = value - parameters[idx];
+	parameters[idx] = value;
+	update( idx, delta );
+}
+
+void IsohedralTiling::computeBatch( const double *params, size_t n,
+	const TilingBatch& out, size_t num_threads ) const
+{
+	size_t np = num_params;
+	size_t stride = np + 1;
+	size_t ntv = numVertices();
+	size_t sz = numAspects();
+
+	// Every output coordinate is a row of some coefficient table dotted
+	// with the parameters.  Collect the rows that were asked for, and the
+	// run of the output that each one fills.
+	struct Row {
+		const double *coeffs;
+		double *dest;
+	};
+	std::vector<Row> rows;
+	if( out.vertices ) {
+		for( size_t r = 0; r < 2*ntv; ++r ) {
+			rows.push_back( 
+				{ tiling_vertex_coefficients + r*stride, out.vertices + r*n } );
+		}
+	}
+	if( out.translations ) {
+		for( size_t r = 0; r < 4; ++r ) {
+			rows.push_back( { translation_vector_coefficients + r*stride, 
+				out.translations + r*n } );
+		}
+	}
+	if( out.aspects ) {
+		// The table holds each matrix row by row; the output wants it
+		// column by column.
+		for( size_t r = 0; r < 6*sz; ++r ) {
+			size_t a = r / 6;
+			size_t row = (r % 6) / 3;
+			size_t col = r % 3;
+			rows.push_back( { aspect_xform_coefficients + r*stride, 
+				out.aspects + (6*a + 2*col + row)*n } );
+		}
+	}
+
+	// Work through the parameter sets a block at a time: transpose the 
+	// block so that each parameter's values are contiguous, and then each
+	// row of output is a sequence of multiply-adds down whole runs, in 
+	// the same order as ddot().
+	const size_t block = 256;
+	size_t num_blocks = (n + block - 1) / block;
+	std::atomic<size_t> next( 0 );
+	auto worker = [&]() {
+		double P[6][block];
+		for( size_t b = next++; b < num_blocks; b = next++ ) {
+			size_t lo = b * block;
+			size_t len = std::min( block, n - lo );
+			for( size_t i = 0; i < len; ++i ) {
+				for( size_t k = 0; k < np; ++k ) {
+					P[k][i] = params[(lo + i)*np + k];
+				}
+			}
+
+			for( const Row& row : rows ) {
+				double *d = row.dest + lo;
+				for( size_t i = 0; i < len; ++i ) {
+					d[i] = 0.0;
+				}
+				for( size_t k = 0; k < np; ++k ) {
+					double c = row.coeffs[k];
+					for( size_t i = 0; i < len; ++i ) {
+						d[i] += c * P[k][i];
+					}
+				}
+				// Affine term.
+				double c = row.coeffs[np];
+				for( size_t i = 0; i < len; ++i ) {
+					d[i] += c;
+				}
+			}
+		}
+	};
+
+	if( num_threads == 0 ) {
+		num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+	}
+	num_threads = std::min( num_threads, num_blocks );
+
+	std::vector<std::thread> pool;
+	for( size_t idx = 1; idx < num_threads; ++idx ) {
+		pool.push_back( std::thread( worker ) );
+	}
+	worker();
+	for( auto& th : pool ) {
+		th.join();
+	}
+}
+
+bool IsohedralTiling::assignParameters( const double *params )
+{
+	U8 changed = 0;
+	for( U8 k = 0; k < num_params; ++k ) {
+		if( params[k] != parameters[k] ) {
+			parameters[k] = params[k];
+			changed |= U8( 1 << k );
+		}
+	}
+	invalidate( changed );
+	return changed != 0;
+}
+
+void IsohedralTiling::invalidate( U8 changed )
+{
+	if( changed & vertex_params ) {
+		++geometry_version;
+		stale |= STALE_VERTICES | STALE_EDGES | STALE_BOUNDS;
+	}
+	if( changed & lattice_params ) {
+		++lattice_version;
+		stale |= STALE_ASPECTS | STALE_BOUNDS | STALE_TRANSLATIONS;
+	}
+}
+
+void IsohedralTiling::addToParameter( U8 idx, double delta )
+{
+	parameters[idx] += delta;
+	update( idx, delta );
+}
+
 U8 IsohedralTiling::numEdgeShapes() const
 {
 	return ttd->num_edge_shapes;
@@ -85,11 +475,23 @@ U8 IsohedralTiling::numAspects() const
 	return ttd->num_aspects;
 }
 
-const glm::dmat3& IsohedralTiling::getAspectTransform( U8 idx ) const
+glm::dmat3 IsohedralTiling::getAspectTransform( U8 idx ) const
+{
+	return getAspectAffine( idx ).toMat3();
+}
+
+const AffineXform& IsohedralTiling::getAspectAffine( U8 idx ) const
 {
 	return aspects[ idx ];
 }
 
+void IsohedralTiling::getAspectBounds( 
+	U8 idx, glm::dvec2& lo, glm::dvec2& hi ) const
+{
+	lo = aspect_bounds[ idx ][ 0 ];
+	hi = aspect_bounds[ idx ][ 1 ];
+}
+
 FillAlgorithm IsohedralTiling::fillRegion( 
 	double xmin, double ymin, double xmax, double ymax, bool dbg ) const
 {
@@ -107,15 +509,119 @@ FillAlgorithm IsohedralTiling::fillRegion(
 	return FillAlgorithm( *this, A, B, C, D, dbg );
 }
 
-U8 IsohedralTiling::getColour( int t1, int t2, U8 aspect ) const
+FillAlgorithm IsohedralTiling::fillRegion( 
+	double xmin, double ymin, double xmax, double ymax, 
+	const FillOptions& opts, bool dbg ) const
+{
+	return FillAlgorithm( *this, 
+		glm::dvec2( xmin, ymin ), 
+		glm::dvec2( xmax, ymin ), 
+		glm::dvec2( xmax, ymax ), 
+		glm::dvec2( xmin, ymax ), opts, dbg );
+}
+
+FillAlgorithm IsohedralTiling::fillRegion( 
+	const glm::dvec2& A, const glm::dvec2& B, 
+	const glm::dvec2& C, const glm::dvec2& D, 
+	const FillOptions& opts, bool dbg ) const
+{
+	return FillAlgorithm( *this, A, B, C, D, opts, dbg );
+}
+
+FillAlgorithm IsohedralTiling::fillPolygon( 
+	const std::vector<glm::dvec2>& poly, const FillOptions& opts ) const
+{
+	return FillAlgorithm( *this, 
+		std::vector<std::vector<glm::dvec2>>( 1, poly ), opts );
+}
+
+FillAlgorithm IsohedralTiling::fillPolygon( 
+	const std::vector<std::vector<glm::dvec2>>& contours, 
+	const FillOptions& opts ) const
+{
+	return FillAlgorithm( *this, contours, opts );
+}
+
+FillAlgorithm IsohedralTiling::fillMask( 
+	const FillMask& mask, const FillOptions& opts ) const
+{
+	return FillAlgorithm( *this, mask, opts );
+}
+
+FillAlgorithm IsohedralTiling::fillDisk( 
+	const glm::dvec2& centre, double radius, const FillOptions& opts ) const
+{
+	// Fill a regular polygon circumscribed about the disk, with enough
+	// sides that the excess is under a fifth of a percent of the radius.
+	const size_t n = 64;
+	double r = radius / cos( glm::pi<double>() / n );
+	std::vector<glm::dvec2> poly;
+	for( size_t idx = 0; idx < n; ++idx ) {
+		double a = 2.0 * glm::pi<double>() * idx / n;
+		poly.push_back( centre + r * glm::dvec2( cos( a ), sin( a ) ) );
+	}
+
+	return fillPolygon( poly, opts );
+}
+
+double IsohedralTiling::estimateFillSize( 
+	double xmin, double ymin, double xmax, double ymax ) const
+{
+	return FillAlgorithm::estimateSize( *this, 
+		glm::dvec2( xmin, ymin ), 
+		glm::dvec2( xmax, ymin ), 
+		glm::dvec2( xmax, ymax ), 
+		glm::dvec2( xmin, ymax ) );
+}
+
+double IsohedralTiling::estimateFillSize( 
+	const glm::dvec2& A, const glm::dvec2& B, 
+	const glm::dvec2& C, const glm::dvec2& D ) const
+{
+	return FillAlgorithm::estimateSize( *this, A, B, C, D );
+}
+
+template<typename T>
+size_t IsohedralTiling::fillRegionInto(
+	double xmin, double ymin, double xmax, double ymax,
+	const glm::dmat3& view, const BasicFillBuffers<T>& out ) const
+{
+	return fillRegion( xmin, ymin, xmax, ymax ).fillInto( view, out );
+}
+
+template<typename T>
+size_t IsohedralTiling::fillRegionInto(
+	const glm::dvec2& A, const glm::dvec2& B,
+	const glm::dvec2& C, const glm::dvec2& D,
+	const glm::dmat3& view, const BasicFillBuffers<T>& out ) const
+{
+	return fillRegion( A, B, C, D ).fillInto( view, out );
+}
+
+template size_t IsohedralTiling::fillRegionInto( 
+	double, double, double, double, 
+	const glm::dmat3&, const FillBuffers& ) const;
+template size_t IsohedralTiling::fillRegionInto( 
+	double, double, double, double, 
+	const glm::dmat3&, const FloatFillBuffers& ) const;
+template size_t IsohedralTiling::fillRegionInto( 
+	const glm::dvec2&, const glm::dvec2&, 
+	const glm::dvec2&, const glm::dvec2&, 
+	const glm::dmat3&, const FillBuffers& ) const;
+template size_t IsohedralTiling::fillRegionInto( 
+	const glm::dvec2&, const glm::dvec2&, 
+	const glm::dvec2&, const glm::dvec2&, 
+	const glm::dmat3&, const FloatFillBuffers& ) const;
+
+U8 IsohedralTiling::getColour( I64 t1, I64 t2, U8 aspect ) const
 {
 	U8 nc = colouring[18];
 
-	int mt1 = t1 % nc;
+	int mt1 = int( t1 % nc );
 	if( mt1 < 0 ) {
 		mt1 += nc;
 	}
-	int mt2 = t2 % nc;
+	int mt2 = int( t2 % nc );
 	if( mt2 < 0 ) {
 		mt2 += nc;
 	}
@@ -145,17 +651,14 @@ static inline double ddot(
 }
 
 static void fillMatrix( 
-	const double *coeffs, const double *params, U8 np, glm::dmat3& M )
+	const double *coeffs, const double *params, U8 np, AffineXform& M )
 {
 	for( U8 row = 0; row < 2; ++row ) {
 		for( U8 col = 0; col < 3; ++col ) {
-			M[col][row] = ddot( coeffs, params, np );
+			M.col[col][row] = ddot( coeffs, params, np );
 			coeffs += (np+1);
 		}
 	}
-	M[0][2] = 0.0;
-	M[1][2] = 0.0;
-	M[2][2] = 1.0;
 }
 
 static void fillVector(
@@ -165,303 +668,2667 @@ static void fillVector(
 	v.y = ddot( coeffs + (np+1), params, np );
 }
 
-static inline glm::dmat3 match( const glm::dvec2& p, const glm::dvec2& q )
+static inline AffineXform match( const glm::dvec2& p, const glm::dvec2& q )
 {
-	return glm::dmat3( 
-		q.x - p.x, q.y - p.y, 0.0,
-		p.y - q.y, q.x - p.x, 0.0,
-		p.x, p.y, 1.0 );
+	return AffineXform( 
+		glm::dvec2( q.x - p.x, q.y - p.y ),
+		glm::dvec2( p.y - q.y, q.x - p.x ),
+		p );
 }
 
-static const glm::dmat3 M_orients[4] = {
-	glm::dmat3( 1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 ),   // IDENTITY
-	glm::dmat3( -1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 1.0, 0.0, 1.0 ), // ROT
-	glm::dmat3( -1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 1.0, 0.0, 1.0 ),  // FLIP
-	glm::dmat3( 1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, 1.0 ),  // ROFL
+static const AffineXform M_orients[4] = {
+	AffineXform( glm::dvec2( 1.0, 0.0 ), glm::dvec2( 0.0, 1.0 ), 
+		glm::dvec2( 0.0, 0.0 ) ),   // IDENTITY
+	AffineXform( glm::dvec2( -1.0, 0.0 ), glm::dvec2( 0.0, -1.0 ), 
+		glm::dvec2( 1.0, 0.0 ) ),   // ROT
+	AffineXform( glm::dvec2( -1.0, 0.0 ), glm::dvec2( 0.0, 1.0 ), 
+		glm::dvec2( 1.0, 0.0 ) ),   // FLIP
+	AffineXform( glm::dvec2( 1.0, 0.0 ), glm::dvec2( 0.0, -1.0 ), 
+		glm::dvec2( 0.0, 0.0 ) ),   // ROFL
 };
 
 void IsohedralTiling::recompute()
 {
+	// Bring the stale products up to date, and no others.  Each one is
+	// computed only from products that come before it here.
+	U8 what = stale;
+
 	U8 ntv = numVertices();
+	U8 sz = numAspects();
 
 	// Recompute tiling vertex locations.
-	const double *data = tiling_vertex_coefficients;
-	for( U8 idx = 0; idx < ntv; ++idx ) {
-		fillVector( data, parameters, num_params, verts[idx] );
-		data += 2*(num_params+1);
+	if( what & STALE_VERTICES ) {
+		const double *data = tiling_vertex_coefficients;
+		for( U8 idx = 0; idx < ntv; ++idx ) {
+			fillVector( data, parameters, num_params, verts[idx] );
+			data += 2*(num_params+1);
+		}
 	}
 
-	// Recompute edge transforms and reversals from orientation information.
-	for( U8 idx = 0; idx < ntv; ++idx ) {
-		bool fl = edge_shape_orientations[ 2*idx ];
-		bool ro = edge_shape_orientations[ 2*idx+1 ];
-		reversals[idx] = (fl != ro);
-		edges[idx] = match( verts[idx], verts[(idx+1)%ntv] ) 
-			* M_orients[2*fl+ro];
+	// Recompute edge transforms from orientation information.
+	if( what & STALE_EDGES ) {
+		for( U8 idx = 0; idx < ntv; ++idx ) {
+			computeEdge( idx );
+		}
 	}
 
 	// Recompute aspect xforms.
-	data = aspect_xform_coefficients;
-	U8 sz = numAspects();
-	for( U8 idx = 0; idx < sz; ++idx ) {
-		fillMatrix( data, parameters, num_params, aspects[idx] );
-		data += 6*(num_params+1);
+	if( what & STALE_ASPECTS ) {
+		const double *data = aspect_xform_coefficients;
+		for( U8 idx = 0; idx < sz; ++idx ) {
+			fillMatrix( data, parameters, num_params, aspects[idx] );
+			data += 6*(num_params+1);
+		}
+	}
+
+	// Recompute the bounding box of the tiling polygon in each aspect.
+	if( what & STALE_BOUNDS ) {
+		for( U8 idx = 0; idx < sz; ++idx ) {
+			computeAspectBounds( idx );
+		}
 	}
 
 	// Recompute translation vectors.
-	data = translation_vector_coefficients;
-	fillVector( data, parameters, num_params, t1 );
-	fillVector( data + 2*(num_params+1), parameters, num_params, t2 );
+	if( what & STALE_TRANSLATIONS ) {
+		const double *data = translation_vector_coefficients;
+		fillVector( data, parameters, num_params, t1 );
+		fillVector( data + 2*(num_params+1), parameters, num_params, t2 );
+	}
+
+	stale = 0;
 }
 
-void FillRegionIterator::dbg() const
+void IsohedralTiling::computeEdge( U8 idx )
 {
-	if( done ) {
-		cerr << "[done]" << endl;
-	} else {
-		cerr << "[call_idx = " << call_idx << "; "
-			 << "x = " << x << "; "
-			 << "y = " << y << "; "
-			 << "xlo = " << xlo << "; "
-			 << "xhi = " << xhi << "; "
-			 << "asp = " << asp << "]" << endl;
-	}
+	bool fl = edge_shape_orientations[ 2*idx ];
+	bool ro = edge_shape_orientations[ 2*idx+1 ];
+	edges[idx] = match( verts[idx], verts[(idx+1)%numVertices()] ) 
+		* M_orients[2*fl+ro];
 }
 
-bool FillRegionIterator::operator ==( const FillRegionIterator& other ) const
+void IsohedralTiling::computeAspectBounds( U8 idx )
 {
-	if( &algo != &other.algo ) {
-		return false;
-	}
-	if( done != other.done ) {
-		return false;
+	glm::dvec2 lo( aspects[idx] * verts[0] );
+	glm::dvec2 hi( lo );
+	for( U8 v = 1; v < numVertices(); ++v ) {
+		glm::dvec2 P( aspects[idx] * verts[v] );
+		lo = glm::min( lo, P );
+		hi = glm::max( hi, P );
 	}
-	if( done ) {
-		return true;
-	}
-
-	return (call_idx == other.call_idx) 
-		&& (fabs( x - other.x ) < 1e-7)
-		&& (fabs( y - other.y ) < 1e-7)
-		&& (asp == other.asp);
+	aspect_bounds[idx][0] = lo;
+	aspect_bounds[idx][1] = hi;
 }
 
-void FillRegionIterator::inc()
+// Incremental updates leave each coordinate within a few ulps per step
+// of the value a full recompute would give.  Start afresh every so often
+// so the errors can't pile up.
+static const unsigned max_updates = 256;
+
+void IsohedralTiling::getVertexJacobian( U8 idx, glm::dvec2 *d ) const
 {
-	++asp;
-	if( asp < algo.tiling.numAspects() ) {
-		return;
+	size_t stride = num_params + 1;
+	const double *data = tiling_vertex_coefficients + 2*idx*stride;
+	for( U8 k = 0; k < num_params; ++k ) {
+		d[k] = glm::dvec2( data[k], data[stride + k] );
 	}
+}
 
-	asp = 0;
-	x = x + 1.0;
-	if( x < (xhi + 1e-7) ) {
-		return;
+void IsohedralTiling::getTranslationJacobian( 
+	glm::dvec2 *dt1, glm::dvec2 *dt2 ) const
+{
+	size_t stride = num_params + 1;
+	const double *data = translation_vector_coefficients;
+	for( U8 k = 0; k < num_params; ++k ) {
+		dt1[k] = glm::dvec2( data[k], data[stride + k] );
+		dt2[k] = glm::dvec2( data[2*stride + k], data[3*stride + k] );
 	}
+}
 
-	xlo += algo.data[call_idx].dxlo;
-	xhi += algo.data[call_idx].dxhi;
-	y = y + 1.0;
-	x = floor( xlo );
-	/*
-	if( y < algo.data[call_idx].ymax ) {
-		return;
-	}
-	*/
-	if( floor(y) < floor(algo.data[call_idx].ymax) ) {
-		return;
+void IsohedralTiling::getAspectJacobian( U8 idx, AffineXform *d ) const
+{
+	// The table holds each matrix row by row.
+	size_t stride = num_params + 1;
+	const double *data = aspect_xform_coefficients + 6*idx*stride;
+	for( U8 k = 0; k < num_params; ++k ) {
+		for( size_t c = 0; c < 3; ++c ) {
+			d[k].col[c] = glm::dvec2( 
+				data[c*stride + k], data[(3 + c)*stride + k] );
+		}
 	}
+}
 
-	++call_idx;
-	if( call_idx < algo.num_calls ) {
-		xlo = algo.data[call_idx].xlo;
-		xhi = algo.data[call_idx].xhi;
-		y = std::max( y, floor( algo.data[call_idx].ymin ) );
-		x = floor( algo.data[call_idx].xlo );
-		return;
+void IsohedralTiling::getEdgeJacobian( U8 idx, AffineXform *d ) const
+{
+	// An edge transform is match() of its endpoints, which is linear in 
+	// them, composed with a constant orientation.  So its derivative is
+	// the same composition applied to the endpoints' derivatives.
+	glm::dvec2 dp[6];
+	glm::dvec2 dq[6];
+	getVertexJacobian( idx, dp );
+	getVertexJacobian( U8( (idx+1) % numVertices() ), dq );
+
+	bool fl = edge_shape_orientations[ 2*idx ];
+	bool ro = edge_shape_orientations[ 2*idx+1 ];
+	for( U8 k = 0; k < num_params; ++k ) {
+		d[k] = match( dp[k], dq[k] ) * M_orients[2*fl+ro];
 	}
-
-	done = true;
 }
 
-FillRegionIterator::FillRegionIterator( const FillAlgorithm& alg )
-	: algo( alg )
-	, done( true )
-{}
-
-FillRegionIterator::FillRegionIterator( const FillAlgorithm& alg, 
-		double xx, double yy, double xxlo, double xxhi )
-	: algo( alg )
-	, done( false )
-	, call_idx( 0 )
-	, x( xx )
-	, y( yy )
-	, xlo( xxlo )
-	, xhi( xxhi )
-	, asp( 0 )
-{}
-
-static glm::dvec2 sampleAtHeight( 
-	const glm::dvec2& P, const glm::dvec2& Q, double y )
+void IsohedralTiling::getEdgePointJacobians( U8 idx, 
+	const glm::dvec2 *pts, size_t n, glm::dvec2 *d ) const
 {
-	double t = (y-P.y)/(Q.y-P.y);
-	return glm::dvec2( (1.0-t)*P.x + t*Q.x, y );
+	// A point's image is affine in the edge transform, so the point's
+	// derivative is the transform's derivative applied to it.
+	AffineXform dE[6];
+	getEdgeJacobian( idx, dE );
+	for( size_t i = 0; i < n; ++i ) {
+		for( U8 k = 0; k < num_params; ++k ) {
+			d[i*num_params + k] = dE[k] * pts[i];
+		}
+	}
 }
 
-void FillAlgorithm::doFill( 
-	const glm::dvec2& A, const glm::dvec2& B,
-	const glm::dvec2& C, const glm::dvec2& D, bool do_top )
+void IsohedralTiling::fitVertices( 
+	const glm::dvec2 *targets, double *params ) const
 {
-	data[num_calls].xlo = A.x;
-	data[num_calls].dxlo = (D.x-A.x)/(D.y-A.y);
-	data[num_calls].xhi = B.x;
-	data[num_calls].dxhi = (C.x-B.x)/(C.y-B.y);
-	data[num_calls].ymin = A.y;
-	data[num_calls].ymax = C.y;
-	if( do_top ) {
-		data[num_calls].ymax += 1.0;
+	size_t nr = 2 * size_t( numVertices() );
+	double dv[12];
+	for( U8 v = 0; v < numVertices(); ++v ) {
+		dv[2*v] = targets[v].x - verts[v].x;
+		dv[2*v+1] = targets[v].y - verts[v].y;
 	}
 
-	if( debug ) {
-		cerr << "Fill[" << num_calls << "]:" << endl;
-		cerr << "\tA = " << A.x << ", " << A.y << endl;
-		cerr << "\tB = " << B.x << ", " << B.y << endl;
-		cerr << "\tC = " << C.x << ", " << C.y << endl;
-		cerr << "\tD = " << D.x << ", " << D.y << endl;
-		cerr << "\txlo = " << data[num_calls].xlo << endl;
-		cerr << "\tdxlo = " << data[num_calls].dxlo << endl;
-		cerr << "\txhi = " << data[num_calls].xhi << endl;
-		cerr << "\tdxhi = " << data[num_calls].dxhi << endl;
-		cerr << "\tymin = " << data[num_calls].ymin << endl;
-		cerr << "\tymax = " << data[num_calls].ymax << endl;
+	for( U8 k = 0; k < num_params; ++k ) {
+		const double *row = vertex_pinv + k*nr;
+		double total = parameters[k];
+		for( size_t r = 0; r < nr; ++r ) {
+			total += row[r] * dv[r];
+		}
+		params[k] = total;
 	}
-
-	++num_calls;
 }
 
-void FillAlgorithm::fillFixX( 
-	const glm::dvec2& A, const glm::dvec2& B,
-	const glm::dvec2& C, const glm::dvec2& D, bool do_top )
+void IsohedralTiling::fitVertex( 
+	U8 idx, const glm::dvec2& target, double *params ) const
 {
-	if( A.x > B.x ) {
-		doFill( B, A, D, C, do_top );
-	} else {
-		doFill( A, B, C, D, do_top );
-	}
-}
-	
-void FillAlgorithm::fillFixY(
-	const glm::dvec2& A, const glm::dvec2& B,
-	const glm::dvec2& C, const glm::dvec2& D, bool do_top )
-{
-	if( A.y > C.y ) {
-		doFill( C, D, A, B, do_top );
-	} else {
-		doFill( A, B, C, D, do_top );
+	size_t nr = 2 * size_t( numVertices() );
+	glm::dvec2 dv = target - verts[idx];
+	for( U8 k = 0; k < num_params; ++k ) {
+		const double *row = vertex_pinv + k*nr + 2*idx;
+		params[k] = parameters[k] + row[0]*dv.x + row[1]*dv.y;
 	}
 }
 
-FillAlgorithm::FillAlgorithm( const IsohedralTiling &t, 
-		const glm::dvec2& A, const glm::dvec2& B, 
-		const glm::dvec2& C, const glm::dvec2& D, bool dbg )
-	: tiling( t )
-	, num_calls( 0 )
-	, debug( dbg )
+void IsohedralTiling::update( U8 idx, double delta )
 {
-	const glm::dvec2& t1 = tiling.getT1();
-	const glm::dvec2& t2 = tiling.getT2();
-
-	double det = 1.0 / (t1.x*t2.y-t2.x*t1.y);
-
-	glm::dmat2 Mbc( t2.y * det, -t1.y * det, -t2.x * det, t1.x * det );
-
-	glm::vec2 pts[4] = {
-		Mbc * glm::dvec2( A ),
-		Mbc * glm::dvec2( B ),
-		Mbc * glm::dvec2( C ),
-		Mbc * glm::dvec2( D )
-	};
-
-	if( det < 0.0 ) {
-		swap( pts[1], pts[3] );
+	U8 bit = U8( 1 << idx );
+	if( delta == 0.0 ) {
+		return;
 	}
-
-	if( debug ) {
-		cerr << "pts[0] = " << pts[0].x << ", " << pts[0].y << endl;
-		cerr << "pts[1] = " << pts[1].x << ", " << pts[1].y << endl;
-		cerr << "pts[2] = " << pts[2].x << ", " << pts[2].y << endl;
-		cerr << "pts[3] = " << pts[3].x << ", " << pts[3].y << endl;
+	if( bit & vertex_params ) {
+		++geometry_version;
+	}
+	if( bit & lattice_params ) {
+		++lattice_version;
+	}
+	if( ++num_updates > max_updates ) {
+		num_updates = 0;
+		stale = STALE_ALL;
+		recompute();
+		return;
 	}
 
-	if( fabs( pts[0].y - pts[1].y ) < 1e-7 ) {
-		fillFixY( pts[0], pts[1], pts[2], pts[3], true );
-	} else if( fabs( pts[1].y - pts[2].y ) < 1e-7 ) {
-		fillFixY( pts[1], pts[2], pts[3], pts[0], true );
-	} else {
-		size_t lowest = 0;
-		for( size_t idx = 1; idx < 4; ++idx ) {
-			if( pts[idx].y < pts[lowest].y ) {
-				lowest = idx;
-			}
-		}
-
-		glm::dvec2 bottom = pts[lowest];
-		glm::dvec2 left = pts[(lowest+1)%4];
-		glm::dvec2 top = pts[(lowest+2)%4];
-		glm::dvec2 right = pts[(lowest+3)%4];
+	// Coefficients for one parameter are spaced np+1 apart, so walk down
+	// each table's column for this parameter.
+	size_t stride = num_params + 1;
+	U8 ntv = numVertices();
+	U8 sz = numAspects();
 
-		if( debug ) {
-			cerr << "bottom = " << bottom.x << ", " << bottom.y << endl;
-			cerr << "left = " << left.x << ", " << left.y << endl;
-			cerr << "top = " << top.x << ", " << top.y << endl;
-			cerr << "right = " << right.x << ", " << right.y << endl;
+	bool moved[6] = { false, false, false, false, false, false };
+	bool any_moved = false;
+	const double *data = tiling_vertex_coefficients + idx;
+	for( U8 v = 0; v < ntv; ++v ) {
+		double cx = data[0];
+		double cy = data[stride];
+		moved[v] = (cx != 0.0) || (cy != 0.0);
+		if( moved[v] ) {
+			verts[v].x += cx * delta;
+			verts[v].y += cy * delta;
+			any_moved = true;
 		}
+		data += 2*stride;
+	}
 
-		if( left.x > right.x ) {
-			swap( left, right );
+	for( U8 e = 0; e < ntv; ++e ) {
+		if( moved[e] || moved[(e+1)%ntv] ) {
+			computeEdge( e );
 		}
+	}
 
-/*
-		if( fabs( left.y - right.y ) < 1e-7 ) {
-			fillFixX( bottom, bottom, right, left, false );
-			fillFixX( left, right, top, top, true );
-		} else
-	*/	
-		if( left.y < right.y ) {
-			glm::vec2 r1 = sampleAtHeight( bottom, right, left.y );
-			glm::vec2 l2 = sampleAtHeight( left, top, right.y );
-			fillFixX( bottom, bottom, r1, left, false );
-			fillFixX( left, r1, right, l2, false );
-			fillFixX( l2, right, top, top, true );
-		} else {
-			glm::vec2 l1 = sampleAtHeight( bottom, left, right.y );
-			glm::vec2 r2 = sampleAtHeight( right, top, left.y );
-			fillFixX( bottom, bottom, right, l1, false );
-			fillFixX( l1, right, r2, left, false );
-			fillFixX( left, r2, top, top, true );
+	data = aspect_xform_coefficients + idx;
+	for( U8 a = 0; a < sz; ++a ) {
+		bool changed = false;
+		for( U8 row = 0; row < 2; ++row ) {
+			for( U8 col = 0; col < 3; ++col ) {
+				if( *data != 0.0 ) {
+					aspects[a].col[col][row] += *data * delta;
+					changed = true;
+				}
+				data += stride;
+			}
+		}
+		if( changed || any_moved ) {
+			computeAspectBounds( a );
 		}
 	}
+
+	data = translation_vector_coefficients + idx;
+	t1.x += data[0] * delta;
+	t1.y += data[stride] * delta;
+	t2.x += data[2*stride] * delta;
+	t2.y += data[3*stride] * delta;
 }
 
-FillRegionIterator FillAlgorithm::begin() const
+TilingGeometry::TilingGeometry( TilingType type, const double *params )
+	: tiling( type )
 {
-	return FillRegionIterator( *this, 
-		floor( data[0].xlo ), floor( data[0].ymin ), data[0].xlo, data[0].xhi );
+	tiling.setParameters( params );
 }
 
-FillRegionIterator FillAlgorithm::end() const
+TilingGeometry::TilingGeometry( const IsohedralTiling& t )
+	: tiling( t )
+{}
+
+const double TilingGeometry::quantum = 1.0 / 4294967296.0;
+
+struct InternKey {
+	TilingType type;
+	I64 q[6];
+
+	bool operator ==( const InternKey& other ) const
+	{
+		return (type == other.type) 
+			&& std::equal( q, q + 6, other.q );
+	}
+};
+
+struct InternKeyHash {
+	size_t operator ()( const InternKey& key ) const
+	{
+		std::uint64_t h = 14695981039346656037ull ^ key.type;
+		for( I64 v : key.q ) {
+			h = (h ^ std::uint64_t( v )) * 1099511628211ull;
+			h ^= h >> 29;
+		}
+		return size_t( h );
+	}
+};
+
+// The intern table is split into shards, each with its own lock, so that
+// threads interning different geometries rarely wait on one another.
+// Entries whose geometry has died are swept out whenever a shard doubles
+// in size.
+struct InternShard {
+	InternShard();
+
+	std::mutex lock;
+	std::unordered_map<InternKey, 
+		std::weak_ptr<const TilingGeometry>, InternKeyHash> table;
+	size_t prune_at;
+};
+
+InternShard::InternShard()
+	: prune_at( 64 )
+{}
+
+static const size_t num_intern_shards = 16;
+
+static InternShard& internShard( size_t hash )
+{
+	static InternShard shards[ num_intern_shards ];
+	return shards[ hash % num_intern_shards ];
+}
+
+std::shared_ptr<const TilingGeometry> TilingGeometry::intern( 
+	TilingType type, const double *params )
+{
+	InternKey key;
+	key.type = type;
+	double qparams[6];
+	U8 np = tiling_type_data[ type ].num_params;
+	for( U8 k = 0; k < 6; ++k ) {
+		if( k >= np ) {
+			key.q[k] = 0;
+		} else {
+			// llround() is undefined for anything outside the range of I64.
+			double q = params[k] / quantum;
+			if( !(std::fabs( q ) < 9223372036854775808.0) ) {
+				return std::shared_ptr<const TilingGeometry>();
+			}
+			key.q[k] = std::llround( q );
+		}
+		qparams[k] = double( key.q[k] ) * quantum;
+	}
+
+	size_t hash = InternKeyHash()( key );
+	InternShard& shard = internShard( hash );
+	{
+		std::lock_guard<std::mutex> guard( shard.lock );
+		auto i = shard.table.find( key );
+		if( i != shard.table.end() ) {
+			std::shared_ptr<const TilingGeometry> ret = i->second.lock();
+			if( ret ) {
+				return ret;
+			}
+		}
+	}
+
+	// Compute the geometry without holding the lock.  If another thread
+	// interned the same one in the meantime, use theirs.  It's allocated
+	// apart from its reference counts, not with make_shared(), so that 
+	// the table's weak reference doesn't keep it in memory once it dies.
+	std::shared_ptr<const TilingGeometry> geom( 
+		new TilingGeometry( type, qparams ) );
+
+	std::lock_guard<std::mutex> guard( shard.lock );
+	std::weak_ptr<const TilingGeometry>& slot = shard.table[ key ];
+	std::shared_ptr<const TilingGeometry> ret = slot.lock();
+	if( ret ) {
+		return ret;
+	}
+	slot = geom;
+
+	if( shard.table.size() >= shard.prune_at ) {
+		for( auto i = shard.table.begin(); i != shard.table.end(); ) {
+			if( i->second.expired() ) {
+				i = shard.table.erase( i );
+			} else {
+				++i;
+			}
+		}
+		shard.prune_at = std::max( size_t( 64 ), 2 * shard.table.size() );
+	}
+
+	return geom;
+}
+
+SharedTiling::SharedTiling( TilingType type )
+	: current( std::make_shared<const TilingGeometry>( 
+		IsohedralTiling( type ) ) )
+{}
+
+SharedTiling::SharedTiling( std::shared_ptr<const TilingGeometry> geom )
+	: current( std::move( geom ) )
+{}
+
+std::shared_ptr<const TilingGeometry> SharedTiling::snapshot() const
+{
+	std::lock_guard<std::mutex> guard( lock );
+	return current;
+}
+
+void SharedTiling::publish( std::shared_ptr<const TilingGeometry> geom )
+{
+	// The old geometry is released after the lock, in case this was the
+	// last reference to it.
+	{
+		std::lock_guard<std::mutex> guard( lock );
+		current.swap( geom );
+	}
+}
+
+void SharedTiling::publish( const IsohedralTiling& tiling )
+{
+	publish( std::make_shared<const TilingGeometry>( tiling ) );
+}
+
+// Apply how to a copy of the current tiling, outside the lock, and 
+// publish the result, starting over if some other writer published 
+// first.
+template<typename Edit>
+void SharedTiling::edit( Edit how )
+{
+	std::shared_ptr<const TilingGeometry> prev = snapshot();
+	for( ;; ) {
+		IsohedralTiling tiling( prev->getTiling() );
+		how( tiling );
+		std::shared_ptr<const TilingGeometry> next = 
+			std::make_shared<const TilingGeometry>( tiling );
+		std::shared_ptr<const TilingGeometry> seen;
+		{
+			std::lock_guard<std::mutex> guard( lock );
+			if( current == prev ) {
+				current.swap( next );
+				return;
+			}
+			seen = current;
+		}
+		prev.swap( seen );
+	}
+}
+
+void SharedTiling::setParameters( const double *params )
+{
+	edit( [params]( IsohedralTiling& t ) { t.setParameters( params ); } );
+}
+
+void SharedTiling::setParameter( U8 idx, double value )
+{
+	edit( [idx, value]( IsohedralTiling& t ) { 
+		t.setParameter( idx, value ); } );
+}
+
+void SharedTiling::reset( TilingType type )
+{
+	edit( [type]( IsohedralTiling& t ) { t.reset( type ); } );
+}
+
+void FillRegionIterator::dbg() const
+{
+	if( done ) {
+		cerr << "[done]" << endl;
+	} else {
+		const FillSpan& sp = algo.spans[span_idx];
+		cerr << "[span_idx = " << span_idx << "; "
+			 << "x = " << x << "; "
+			 << "row = " << sp.row << "; "
+			 << "begin = " << sp.begin << "; "
+			 << "end = " << sp.end << "; "
+			 << "t1 = " << getT1() << "; "
+			 << "t2 = " << getT2() << "; "
+			 << "asp = " << asp << "]" << endl;
+	}
+}
+
+bool FillRegionIterator::operator ==( const FillRegionIterator& other ) const
+{
+	if( &algo != &other.algo ) {
+		return false;
+	}
+	if( done != other.done ) {
+		return false;
+	}
+	if( done ) {
+		return true;
+	}
+
+	return index == other.index;
+}
+
+FillRegionIterator& FillRegionIterator::advance( size_t n )
+{
+	if( !done ) {
+		algo.seek( *this, index + n );
+	}
+	return *this;
+}
+
+void FillRegionIterator::inc()
+{
+	size_t na = algo.tiling.numAspects();
+
+	++index;
+	do {
+		++asp;
+		if( asp < na ) {
+			continue;
+		}
+
+		asp = 0;
+		++x;
+		if( x < algo.spans[span_idx].end ) {
+			continue;
+		}
+
+		++span_idx;
+		if( span_idx == algo.spans.size() ) {
+			done = true;
+			return;
+		}
+		x = algo.spans[span_idx].begin;
+	} while( !algo.inRange( span_idx, x, asp ) );
+}
+
+FillRegionIterator::FillRegionIterator( const FillAlgorithm& alg )
+	: algo( alg )
+	, done( true )
+	, index( 0 )
+	, span_idx( 0 )
+	, x( 0 )
+	, asp( 0 )
+{}
+
+FillAlgorithm::FillAlgorithm( const IsohedralTiling &t, 
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D, bool dbg )
+	: FillAlgorithm( t, A, B, C, D, FillOptions(), dbg )
+{}
+
+FillAlgorithm::FillAlgorithm( const IsohedralTiling &t, 
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D, 
+		const FillOptions& opts, bool dbg )
+	: tiling( t )
+	, debug( dbg )
+	, budget( opts.max_tiles > 0 ? opts.max_tiles 
+		: std::numeric_limits<size_t>::max() )
+	, truncated( false )
+{
+	// The reduced basis covers the region with the fewest, shortest rows.
+	glm::ivec2 red[2];
+	reduceBasis( tiling, red );
+	setBasis( red[0], red[1] );
+
+	const glm::dvec2 quad[4] = { A, B, C, D };
+	if( rejectEarly( opts, std::vector<std::vector<glm::dvec2>>( 
+			1, std::vector<glm::dvec2>( quad, quad + 4 ) ) ) ) {
+		computeOffsets();
+		return;
+	}
+
+	computeQuadSpans( A, B, C, D, opts.margin, opts.exact );
+	finish( opts );
+}
+
+FillAlgorithm::FillAlgorithm( const IsohedralTiling &t, 
+		const glm::ivec2& u, const glm::ivec2& v,
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D )
+	: tiling( t )
+	, debug( false )
+	, budget( std::numeric_limits<size_t>::max() )
+	, truncated( false )
+{
+	setBasis( u, v );
+	computeQuadSpans( A, B, C, D, 0.0, false );
+	computeOffsets();
+}
+
+FillAlgorithm::FillAlgorithm( const IsohedralTiling &t, 
+		const glm::ivec2& u, const glm::ivec2& v,
+		const std::vector<FillSpan>& sp )
+	: tiling( t )
+	, debug( false )
+	, budget( std::numeric_limits<size_t>::max() )
+	, truncated( false )
+{
+	setBasis( u, v );
+	spans = sp;
+	computeOffsets();
+}
+
+FillAlgorithm::FillAlgorithm( const IsohedralTiling &t, 
+		const std::vector<std::vector<glm::dvec2>>& contours,
+		const FillOptions& opts, bool dbg )
+	: tiling( t )
+	, debug( dbg )
+	, budget( opts.max_tiles > 0 ? opts.max_tiles 
+		: std::numeric_limits<size_t>::max() )
+	, truncated( false )
+{
+	glm::ivec2 red[2];
+	reduceBasis( tiling, red );
+	setBasis( red[0], red[1] );
+	if( rejectEarly( opts, contours ) ) {
+		computeOffsets();
+		return;
+	}
+
+	computePolygonSpans( contours, opts.margin );
+	finish( opts );
+}
+
+FillAlgorithm::FillAlgorithm( const IsohedralTiling &t, 
+		const FillMask& mask, const FillOptions& opts, bool dbg )
+	: tiling( t )
+	, debug( dbg )
+	, budget( opts.max_tiles > 0 ? opts.max_tiles 
+		: std::numeric_limits<size_t>::max() )
+	, truncated( false )
+{
+	glm::ivec2 red[2];
+	reduceBasis( tiling, red );
+	setBasis( red[0], red[1] );
+
+	// Estimate the fill from the box around the covered pixels, placed in
+	// the plane.  An empty mask has nothing to reject.
+	int i0 = mask.width;
+	int j0 = mask.height;
+	int i1 = -1;
+	int j1 = -1;
+	for( int j = 0; j < mask.height; ++j ) {
+		for( int i = 0; i < mask.width; ++i ) {
+			if( mask.hi[0][size_t( j ) * mask.width + i] ) {
+				i0 = std::min( i0, i );
+				j0 = std::min( j0, j );
+				i1 = std::max( i1, i + 1 );
+				j1 = std::max( j1, j + 1 );
+			}
+		}
+	}
+	if( i1 >= 0 ) {
+		std::vector<glm::dvec2> box;
+		const int is[4] = { i0, i1, i1, i0 };
+		const int js[4] = { j0, j0, j1, j1 };
+		for( size_t idx = 0; idx < 4; ++idx ) {
+			box.push_back( glm::dvec2( mask.to_world * glm::dvec3( 
+				double( is[idx] ), double( js[idx] ), 1.0 ) ) );
+		}
+		if( rejectEarly( opts, 
+				std::vector<std::vector<glm::dvec2>>( 1, box ) ) ) {
+			computeOffsets();
+			return;
+		}
+	}
+
+	computeMaskSpans( mask, opts.margin );
+	finish( opts );
+}
+
+double FillAlgorithm::estimateSize( const IsohedralTiling &t, 
+	const glm::dvec2& A, const glm::dvec2& B, 
+	const glm::dvec2& C, const glm::dvec2& D )
+{
+	const glm::dvec2 quad[4] = { A, B, C, D };
+	return estimateTiles( t, std::vector<std::vector<glm::dvec2>>( 
+		1, std::vector<glm::dvec2>( quad, quad + 4 ) ) );
+}
+
+double FillAlgorithm::estimateTiles( const IsohedralTiling& t, 
+	const std::vector<std::vector<glm::dvec2>>& contours )
+{
+	glm::ivec2 red[2];
+	reduceBasis( t, red );
+	glm::dvec2 u = double(red[0].x) * t.getT1() + double(red[0].y) * t.getT2();
+	glm::dvec2 v = double(red[1].x) * t.getT1() + double(red[1].y) * t.getT2();
+
+	double det = fabs( u.x*v.y - u.y*v.x );
+	if( !(det > 0.0) ) {
+		return HUGE_VAL;
+	}
+
+	// The area of a convex region grown by the lattice cell (the 
+	// Minkowski sum of the two) is the region's area, plus the cell's, 
+	// plus half of every edge's cross product with each basis vector.
+	// For other regions the same sum still estimates how many cells 
+	// the boundary touches.
+	double area = 0.0;
+	double grow = 0.0;
+	for( const std::vector<glm::dvec2>& contour : contours ) {
+		double a = 0.0;
+		for( size_t idx = 0; idx < contour.size(); ++idx ) {
+			const glm::dvec2& P = contour[idx];
+			const glm::dvec2& Q = contour[(idx+1)%contour.size()];
+			glm::dvec2 e = Q - P;
+			a += P.x*Q.y - P.y*Q.x;
+			grow += 0.5 * (fabs( e.x*u.y - e.y*u.x ) + fabs( e.x*v.y - e.y*v.x ));
+		}
+		area += 0.5 * fabs( a );
+	}
+
+	return t.numAspects() * (area + grow + det) / det;
+}
+
+bool FillAlgorithm::rejectEarly( const FillOptions& opts, 
+	const std::vector<std::vector<glm::dvec2>>& contours )
+{
+	if( (opts.max_tiles == 0) || (opts.over_budget != REJECT_FILL) ) {
+		return false;
+	}
+	if( !(estimateTiles( tiling, contours ) > double( opts.max_tiles )) ) {
+		return false;
+	}
+
+	if( debug ) {
+		cerr << "Fill rejected: estimate exceeds " << opts.max_tiles << endl;
+	}
+	truncated = true;
+	return true;
+}
+
+void FillAlgorithm::finish( const FillOptions& opts )
+{
+	setOrigin( opts.origin_t1, opts.origin_t2 );
+	computeOffsets();
+
+	// The scan stops as soon as it passes the budget, so a fill that's 
+	// too big shows up here with just a bit more than budget tiles.
+	if( size() <= budget ) {
+		return;
+	}
+
+	truncated = true;
+	if( opts.over_budget == REJECT_FILL ) {
+		spans.clear();
+		ranges.clear();
+		flags.clear();
+		computeOffsets();
+	} else {
+		trim( budget );
+	}
+}
+
+void FillAlgorithm::reduceBasis( const IsohedralTiling& t, glm::ivec2 red[2] )
+{
+	glm::dvec2 b1 = t.getT1();
+	glm::dvec2 b2 = t.getT2();
+	red[0] = glm::ivec2( 1, 0 );
+	red[1] = glm::ivec2( 0, 1 );
+
+	// Keep b1 the shorter vector and subtract the nearest integer multiple
+	// of it from b2, until that no longer helps.  Swaps negate one of the
+	// vectors so that the change of basis preserves orientation.
+	for( size_t iter = 0; iter < 100; ++iter ) {
+		if( glm::dot( b2, b2 ) < glm::dot( b1, b1 ) ) {
+			glm::dvec2 tb = b1;
+			b1 = b2;
+			b2 = -tb;
+			glm::ivec2 tc = red[0];
+			red[0] = red[1];
+			red[1] = -tc;
+		}
+
+		double len = glm::dot( b1, b1 );
+		if( !(len > 0.0) ) {
+			break;
+		}
+		double mu = floor( glm::dot( b1, b2 ) / len + 0.5 );
+		if( (mu == 0.0) || !(fabs( mu ) < 1e6) ) {
+			break;
+		}
+
+		b2 -= mu * b1;
+		red[1] -= int(mu) * red[0];
+	}
+}
+
+void FillAlgorithm::setBasis( const glm::ivec2& u, const glm::ivec2& v )
+{
+	const glm::dvec2& t1 = tiling.getT1();
+	const glm::dvec2& t2 = tiling.getT2();
+
+	basis[0] = u;
+	basis[1] = v;
+	// Build the vectors from their integer coordinates rather than
+	// reusing the ones from the reduction, to avoid accumulated roundoff.
+	for( size_t idx = 0; idx < 2; ++idx ) {
+		basis_vec[idx] = double(basis[idx].x) * t1 + double(basis[idx].y) * t2;
+	}
+
+	spans.clear();
+	ranges.clear();
+	flags.clear();
+	tally = 0;
+	tallied = 0;
+	origin[0] = origin[1] = 0;
+	origin_cell[0] = origin_cell[1] = 0;
+
+	if( debug ) {
+		cerr << "basis[0] = " << basis[0].x << ", " << basis[0].y << endl;
+		cerr << "basis[1] = " << basis[1].x << ", " << basis[1].y << endl;
+	}
+}
+
+void FillAlgorithm::setOrigin( I64 o1, I64 o2 )
+{
+	// The spans so far were computed around the tiling's origin.  Since
+	// the tiling is invariant under its own translations, moving the
+	// region by a lattice vector just moves the spans.  The basis is
+	// unimodular, so the origin has integer coordinates in it too.
+	I64 det = I64( basis[0].x )*basis[1].y - I64( basis[1].x )*basis[0].y;
+
+	origin[0] = o1;
+	origin[1] = o2;
+	origin_cell[0] = (o1*basis[1].y - o2*basis[1].x) * det;
+	origin_cell[1] = (o2*basis[0].x - o1*basis[0].y) * det;
+
+	for( FillSpan& sp : spans ) {
+		sp.row += origin_cell[1];
+		sp.begin += origin_cell[0];
+		sp.end += origin_cell[0];
+	}
+	for( I64& r : ranges ) {
+		r += origin_cell[0];
+	}
+}
+
+void FillAlgorithm::addSpan( I64 row, I64 begin, I64 end )
+{
+	FillSpan sp;
+	sp.row = row;
+	sp.begin = begin;
+	sp.end = end;
+	spans.push_back( sp );
+}
+
+// Andrew's monotone chain; returns the hull in counterclockwise order.
+static std::vector<glm::dvec2> convexHull( std::vector<glm::dvec2> pts )
+{
+	std::sort( pts.begin(), pts.end(), 
+		[]( const glm::dvec2& a, const glm::dvec2& b ) {
+			return (a.x < b.x) || ((a.x == b.x) && (a.y < b.y));
+		} );
+
+	size_t n = pts.size();
+	if( n < 3 ) {
+		return pts;
+	}
+
+	std::vector<glm::dvec2> hull( 2*n );
+	size_t k = 0;
+
+	auto cross = []( const glm::dvec2& O, 
+			const glm::dvec2& A, const glm::dvec2& B ) {
+		return (A.x-O.x)*(B.y-O.y) - (A.y-O.y)*(B.x-O.x);
+	};
+
+	for( size_t idx = 0; idx < n; ++idx ) {
+		while( k >= 2 && cross( hull[k-2], hull[k-1], pts[idx] ) <= 0.0 ) {
+			--k;
+		}
+		hull[k++] = pts[idx];
+	}
+	for( size_t idx = n-1, t = k+1; idx > 0; --idx ) {
+		while( k >= t && cross( hull[k-2], hull[k-1], pts[idx-1] ) <= 0.0 ) {
+			--k;
+		}
+		hull[k++] = pts[idx-1];
+	}
+
+	hull.resize( k-1 );
+	return hull;
+}
+
+// Intersect a convex polygon with the horizontal line at height y.
+static bool rowInterval( const std::vector<glm::dvec2>& poly, double y, 
+	double& xl, double& xr )
+{
+	bool found = false;
+
+	for( size_t idx = 0; idx < poly.size(); ++idx ) {
+		const glm::dvec2& P = poly[idx];
+		const glm::dvec2& Q = poly[(idx+1)%poly.size()];
+
+		if( (y < std::min( P.y, Q.y )) || (y > std::max( P.y, Q.y )) ) {
+			continue;
+		}
+
+		// Treat a nearly horizontal edge as horizontal, so that a row that
+		// just grazes it picks up the whole edge and not one end of it.
+		double lo = std::min( P.x, Q.x );
+		double hi = std::max( P.x, Q.x );
+		if( fabs( Q.y - P.y ) > 1e-9 ) {
+			lo = hi = P.x + (y-P.y)/(Q.y-P.y)*(Q.x-P.x);
+		}
+
+		if( found ) {
+			xl = std::min( xl, lo );
+			xr = std::max( xr, hi );
+		} else {
+			xl = lo;
+			xr = hi;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+void FillAlgorithm::computeQuadSpans(
+	const glm::dvec2& A, const glm::dvec2& B, 
+	const glm::dvec2& C, const glm::dvec2& D, double margin, bool exact )
+{
+	const double eps = 1e-9;
+
+	const glm::dvec2& t1 = basis_vec[0];
+	const glm::dvec2& t2 = basis_vec[1];
+
+	double det = 1.0 / (t1.x*t2.y-t2.x*t1.y);
+	glm::dmat2 Mbc( t2.y * det, -t1.y * det, -t2.x * det, t1.x * det );
+
+	// The tile with aspect asp in the cell at lattice point P has its
+	// bounding box at P + [lo, hi].  That box meets the (convex) query quad
+	// exactly when the cell's origin lies in the quad dilated by the
+	// reflected box.  Map each of those dilated quads into lattice
+	// coordinates, where every row of them is a single interval.  An 
+	// approximate fill takes whole cells, so it makes do with one quad,
+	// dilated by the box around all of a cell's tiles.
+	const glm::dvec2 quad[4] = { A, B, C, D };
+	size_t na = exact ? tiling.numAspects() : 1;
+	std::vector<glm::dvec2> polys[12];
+	double pymin[12];
+	double pymax[12];
+	double ymin = HUGE_VAL;
+	double ymax = -HUGE_VAL;
+
+	for( size_t asp = 0; asp < na; ++asp ) {
+		glm::dvec2 lo;
+		glm::dvec2 hi;
+		tiling.getAspectBounds( asp, lo, hi );
+		for( size_t other = na; other < tiling.numAspects(); ++other ) {
+			glm::dvec2 olo;
+			glm::dvec2 ohi;
+			tiling.getAspectBounds( other, olo, ohi );
+			lo = glm::min( lo, olo );
+			hi = glm::max( hi, ohi );
+		}
+		lo -= margin;
+		hi += margin;
+
+		std::vector<glm::dvec2> pts;
+		for( size_t idx = 0; idx < 4; ++idx ) {
+			pts.push_back( Mbc * (quad[idx] - lo) );
+			pts.push_back( Mbc * (quad[idx] - glm::dvec2( hi.x, lo.y )) );
+			pts.push_back( Mbc * (quad[idx] - hi) );
+			pts.push_back( Mbc * (quad[idx] - glm::dvec2( lo.x, hi.y )) );
+		}
+		polys[asp] = convexHull( pts );
+
+		pymin[asp] = HUGE_VAL;
+		pymax[asp] = -HUGE_VAL;
+		for( const glm::dvec2& P : polys[asp] ) {
+			pymin[asp] = std::min( pymin[asp], P.y );
+			pymax[asp] = std::max( pymax[asp], P.y );
+		}
+		ymin = std::min( ymin, pymin[asp] );
+		ymax = std::max( ymax, pymax[asp] );
+	}
+
+	if( !(ymin <= ymax) ) {
+		return;
+	}
+
+	I64 ybegin = I64( ceil( ymin - eps ) );
+	I64 yend = I64( floor( ymax + eps ) ) + 1;
+	std::vector<I64> row( 2*na );
+
+	for( I64 y = ybegin; y < yend; ++y ) {
+		I64 ubegin = 0;
+		I64 uend = 0;
+
+		for( size_t asp = 0; asp < na; ++asp ) {
+			row[2*asp] = row[2*asp+1] = 0;
+
+			// Clamp onto the polygon, so that a row grazing a vertex
+			// isn't lost to roundoff.
+			double py = y;
+			if( (py < pymin[asp]) && (py > pymin[asp] - eps) ) {
+				py = pymin[asp];
+			} else if( (py > pymax[asp]) && (py < pymax[asp] + eps) ) {
+				py = pymax[asp];
+			}
+
+			double xl;
+			double xr;
+			if( !rowInterval( polys[asp], py, xl, xr ) ) {
+				continue;
+			}
+
+			I64 b = I64( ceil( xl - eps ) );
+			I64 e = I64( floor( xr + eps ) ) + 1;
+			if( b >= e ) {
+				continue;
+			}
+
+			row[2*asp] = b;
+			row[2*asp+1] = e;
+			if( ubegin == uend ) {
+				ubegin = b;
+				uend = e;
+			} else {
+				ubegin = std::min( ubegin, b );
+				uend = std::max( uend, e );
+			}
+		}
+
+		if( ubegin < uend ) {
+			addSpan( y, ubegin, uend );
+			if( exact ) {
+				ranges.insert( ranges.end(), row.begin(), row.end() );
+			}
+		}
+		if( overBudget() ) {
+			break;
+		}
+	}
+
+	if( debug ) {
+		cerr << (exact ? "Exact" : "Approximate") << " fill: " 
+			<< spans.size() << " rows" << endl;
+	}
+}
+
+// Merge a list of [begin, end) ranges in place, sorting them and
+// joining any that overlap or touch.
+static void mergeRanges( std::vector<std::pair<I64,I64>>& rs )
+{
+	std::sort( rs.begin(), rs.end() );
+
+	size_t k = 0;
+	for( size_t idx = 0; idx < rs.size(); ++idx ) {
+		if( (k > 0) && (rs[idx].first <= rs[k-1].second) ) {
+			rs[k-1].second = std::max( rs[k-1].second, rs[idx].second );
+		} else {
+			rs[k++] = rs[idx];
+		}
+	}
+	rs.resize( k );
+}
+
+void FillAlgorithm::computePolygonSpans( 
+	const std::vector<std::vector<glm::dvec2>>& contours, double margin )
+{
+	const double eps = 1e-9;
+
+	const glm::dvec2& t1 = basis_vec[0];
+	const glm::dvec2& t2 = basis_vec[1];
+
+	double det = 1.0 / (t1.x*t2.y-t2.x*t1.y);
+	glm::dmat2 Mbc( t2.y * det, -t1.y * det, -t2.x * det, t1.x * det );
+
+	// The tile with aspect asp in the cell at lattice point P has its
+	// bounding box at P + [lo, hi].  That box meets the polygon when it
+	// crosses one of the polygon's edges, which happens exactly when P
+	// lies in the edge dilated by the reflected box, or when it sits
+	// inside the polygon, in which case so does P + lo.  So for every edge
+	// and aspect, map the dilated edge into lattice coordinates, where
+	// it's a convex polygon covering a single interval of each row.
+	size_t na = tiling.numAspects();
+	glm::dvec2 corners[12][4];
+	for( size_t asp = 0; asp < na; ++asp ) {
+		glm::dvec2 lo;
+		glm::dvec2 hi;
+		tiling.getAspectBounds( asp, lo, hi );
+		lo -= margin;
+		hi += margin;
+
+		corners[asp][0] = Mbc * lo;
+		corners[asp][1] = Mbc * glm::dvec2( hi.x, lo.y );
+		corners[asp][2] = Mbc * hi;
+		corners[asp][3] = Mbc * glm::dvec2( lo.x, hi.y );
+	}
+
+	struct Edge {
+		size_t asp;
+		// The edge, less the lower corner of the aspect's box.
+		glm::dvec2 P;
+		glm::dvec2 Q;
+		std::vector<glm::dvec2> poly;
+		double ymin;
+		double ymax;
+	};
+	std::vector<Edge> edges;
+
+	for( const std::vector<glm::dvec2>& contour : contours ) {
+		for( size_t idx = 0; idx < contour.size(); ++idx ) {
+			glm::dvec2 P = Mbc * contour[idx];
+			glm::dvec2 Q = Mbc * contour[(idx+1)%contour.size()];
+
+			for( size_t asp = 0; asp < na; ++asp ) {
+				Edge e;
+				e.asp = asp;
+				e.P = P - corners[asp][0];
+				e.Q = Q - corners[asp][0];
+
+				std::vector<glm::dvec2> pts;
+				for( size_t c = 0; c < 4; ++c ) {
+					pts.push_back( P - corners[asp][c] );
+					pts.push_back( Q - corners[asp][c] );
+				}
+				e.poly = convexHull( pts );
+				e.ymin = HUGE_VAL;
+				e.ymax = -HUGE_VAL;
+				for( const glm::dvec2& V : e.poly ) {
+					e.ymin = std::min( e.ymin, V.y );
+					e.ymax = std::max( e.ymax, V.y );
+				}
+				edges.push_back( e );
+			}
+		}
+	}
+
+	if( edges.empty() ) {
+		return;
+	}
+
+	std::sort( edges.begin(), edges.end(), 
+		[]( const Edge& a, const Edge& b ) { return a.ymin < b.ymin; } );
+
+	double ymax = -HUGE_VAL;
+	for( const Edge& e : edges ) {
+		ymax = std::max( ymax, e.ymax );
+	}
+	I64 ybegin = I64( ceil( edges.front().ymin - eps ) );
+	I64 yend = I64( floor( ymax + eps ) ) + 1;
+
+	// Scan the rows with an active edge table.  In each row, an aspect
+	// wants the cells covered by its dilated edges, and the cells between
+	// pairs of crossings of its shifted edges (under the even-odd rule).
+	std::vector<size_t> active;
+	size_t next = 0;
+	std::vector<std::pair<I64,I64>> cells[12];
+	std::vector<double> xs[12];
+	std::vector<std::pair<I64,I64>> all;
+
+	for( I64 y = ybegin; y < yend; ++y ) {
+		for( size_t idx = 0; idx < active.size(); ) {
+			if( edges[active[idx]].ymax < y - eps ) {
+				active[idx] = active.back();
+				active.pop_back();
+			} else {
+				++idx;
+			}
+		}
+		while( (next < edges.size()) && (edges[next].ymin <= y + eps) ) {
+			if( !(edges[next].ymax < y - eps) ) {
+				active.push_back( next );
+			}
+			++next;
+		}
+
+		for( size_t asp = 0; asp < na; ++asp ) {
+			cells[asp].clear();
+			xs[asp].clear();
+		}
+
+		for( size_t idx : active ) {
+			const Edge& e = edges[idx];
+
+			// Clamp onto the polygon, so that a row grazing a vertex
+			// isn't lost to roundoff.
+			double py = std::min( std::max( double( y ), e.ymin ), e.ymax );
+			double xl;
+			double xr;
+			if( rowInterval( e.poly, py, xl, xr ) ) {
+				I64 b = I64( ceil( xl - eps ) );
+				I64 en = I64( floor( xr + eps ) ) + 1;
+				if( b < en ) {
+					cells[e.asp].push_back( std::make_pair( b, en ) );
+				}
+			}
+
+			if( (std::min( e.P.y, e.Q.y ) <= y) 
+					&& (y < std::max( e.P.y, e.Q.y )) ) {
+				xs[e.asp].push_back( 
+					e.P.x + (y - e.P.y) / (e.Q.y - e.P.y) * (e.Q.x - e.P.x) );
+			}
+		}
+
+		all.clear();
+		for( size_t asp = 0; asp < na; ++asp ) {
+			std::vector<double>& ex = xs[asp];
+			std::sort( ex.begin(), ex.end() );
+			for( size_t idx = 0; idx + 1 < ex.size(); idx += 2 ) {
+				I64 b = I64( ceil( ex[idx] - eps ) );
+				I64 en = I64( floor( ex[idx+1] + eps ) ) + 1;
+				if( b < en ) {
+					cells[asp].push_back( std::make_pair( b, en ) );
+				}
+			}
+
+			mergeRanges( cells[asp] );
+			all.insert( all.end(), cells[asp].begin(), cells[asp].end() );
+		}
+
+		// Each run of cells wanted by any aspect becomes a span, in which
+		// every aspect gets the hull of its own runs.
+		mergeRanges( all );
+		for( const std::pair<I64,I64>& u : all ) {
+			addSpan( y, u.first, u.second );
+			for( size_t asp = 0; asp < na; ++asp ) {
+				I64 b = 0;
+				I64 en = 0;
+				for( const std::pair<I64,I64>& r : cells[asp] ) {
+					if( (r.second <= u.first) || (r.first >= u.second) ) {
+						continue;
+					}
+					if( b == en ) {
+						b = r.first;
+					}
+					en = r.second;
+				}
+				ranges.push_back( b );
+				ranges.push_back( en );
+			}
+		}
+		if( overBudget() ) {
+			break;
+		}
+	}
+
+	if( debug ) {
+		cerr << "Polygon fill: " << spans.size() << " spans" << endl;
+	}
+}
+
+void FillAlgorithm::computeMaskSpans( const FillMask& mask, double margin )
+{
+	size_t na = tiling.numAspects();
+	const glm::dmat3& W = mask.to_world;
+
+	glm::dvec2 alo[12];
+	glm::dvec2 ahi[12];
+	glm::dvec2 ulo( HUGE_VAL );
+	glm::dvec2 uhi( -HUGE_VAL );
+	for( size_t asp = 0; asp < na; ++asp ) {
+		tiling.getAspectBounds( asp, alo[asp], ahi[asp] );
+		alo[asp] -= margin;
+		ahi[asp] += margin;
+		ulo = glm::min( ulo, alo[asp] );
+		uhi = glm::max( uhi, ahi[asp] );
+	}
+
+	// Tile boxes are tested by their bounding boxes in the mask's
+	// coordinates, which can stick out of the boxes themselves by up to
+	// their diagonal.  So only cells whose lattice points lie within the
+	// mask's bounding box, grown by that much more than a tile box, can
+	// touch it.  Start from the block of cells around that.
+	glm::dvec2 wlo( HUGE_VAL );
+	glm::dvec2 whi( -HUGE_VAL );
+	for( int j = 0; j < 2; ++j ) {
+		for( int i = 0; i < 2; ++i ) {
+			glm::dvec2 P( W * glm::dvec3( 
+				double( i*mask.width ), double( j*mask.height ), 1.0 ) );
+			wlo = glm::min( wlo, P );
+			whi = glm::max( whi, P );
+		}
+	}
+	double slack = glm::length( uhi - ulo );
+	wlo -= uhi + slack;
+	whi -= ulo - slack;
+
+	const glm::dvec2& t1 = basis_vec[0];
+	const glm::dvec2& t2 = basis_vec[1];
+	double det = 1.0 / (t1.x*t2.y-t2.x*t1.y);
+	glm::dmat2 Mbc( t2.y * det, -t1.y * det, -t2.x * det, t1.x * det );
+
+	glm::dvec2 llo( HUGE_VAL );
+	glm::dvec2 lhi( -HUGE_VAL );
+	const glm::dvec2 wc[4] = { 
+		wlo, glm::dvec2( whi.x, wlo.y ), whi, glm::dvec2( wlo.x, whi.y ) };
+	for( size_t idx = 0; idx < 4; ++idx ) {
+		llo = glm::min( llo, Mbc * wc[idx] );
+		lhi = glm::max( lhi, Mbc * wc[idx] );
+	}
+	if( !(llo.x <= lhi.x) || !(llo.y <= lhi.y) ) {
+		return;
+	}
+
+	I64 x0 = I64( floor( llo.x ) );
+	I64 x1 = I64( ceil( lhi.x ) ) + 1;
+	I64 r0 = I64( floor( llo.y ) );
+	I64 r1 = I64( ceil( lhi.y ) ) + 1;
+
+	// The box in mask coordinates around a world box spanning the lattice
+	// points of cells [xa, xb] x [ra, rb], grown by [lo, hi].
+	auto maskBox = [&]( I64 xa, I64 xb, I64 ra, I64 rb, 
+			const glm::dvec2& lo, const glm::dvec2& hi,
+			glm::dvec2& mlo, glm::dvec2& mhi ) {
+		glm::dvec2 wlo( HUGE_VAL );
+		glm::dvec2 whi( -HUGE_VAL );
+		const I64 xs[2] = { xa, xb };
+		const I64 rs[2] = { ra, rb };
+		for( size_t a = 0; a < 2; ++a ) {
+			for( size_t b = 0; b < 2; ++b ) {
+				glm::dvec2 P = double( xs[a] ) * basis_vec[0] 
+					+ double( rs[b] ) * basis_vec[1];
+				wlo = glm::min( wlo, P );
+				whi = glm::max( whi, P );
+			}
+		}
+		wlo += lo;
+		whi += hi;
+
+		mlo = glm::dvec2( HUGE_VAL );
+		mhi = glm::dvec2( -HUGE_VAL );
+		const glm::dvec2 cs[4] = { 
+			wlo, glm::dvec2( whi.x, wlo.y ), whi, glm::dvec2( wlo.x, whi.y ) };
+		for( size_t idx = 0; idx < 4; ++idx ) {
+			glm::dvec2 M( mask.from_world * glm::dvec3( cs[idx], 1.0 ) );
+			mlo = glm::min( mlo, M );
+			mhi = glm::max( mhi, M );
+		}
+	};
+
+	// Subdivide the block of candidate cells, discarding any piece whose
+	// tiles can't touch a covered pixel and accepting any piece whose 
+	// tiles can only touch covered pixels, down to single cells.  Each
+	// accepted run of cells in a row shares one set of flags.
+	struct Run {
+		I64 row;
+		I64 begin;
+		I64 end;
+		U8 flags[12];
+	};
+	std::vector<Run> runs;
+
+	std::function<void( I64, I64, I64, I64 )> block;
+	block = [&]( I64 xa, I64 xb, I64 ra, I64 rb ) {
+		glm::dvec2 mlo;
+		glm::dvec2 mhi;
+		maskBox( xa, xb - 1, ra, rb - 1, ulo, uhi, mlo, mhi );
+		U8 cov = mask.coverage( mlo, mhi );
+		if( cov == 0 ) {
+			return;
+		}
+
+		Run run;
+		if( cov == INSIDE_MASK ) {
+			std::fill( run.flags, run.flags + 12, U8( INSIDE_MASK ) );
+			for( I64 r = ra; r < rb; ++r ) {
+				run.row = r;
+				run.begin = xa;
+				run.end = xb;
+				runs.push_back( run );
+			}
+			return;
+		}
+
+		if( (xb - xa == 1) && (rb - ra == 1) ) {
+			bool any = false;
+			for( size_t asp = 0; asp < na; ++asp ) {
+				maskBox( xa, xa, ra, ra, alo[asp], ahi[asp], mlo, mhi );
+				run.flags[asp] = mask.coverage( mlo, mhi );
+				any = any || (run.flags[asp] != 0);
+			}
+			if( any ) {
+				run.row = ra;
+				run.begin = xa;
+				run.end = xb;
+				runs.push_back( run );
+			}
+			return;
+		}
+
+		if( xb - xa >= rb - ra ) {
+			I64 xm = xa + (xb - xa) / 2;
+			block( xa, xm, ra, rb );
+			block( xm, xb, ra, rb );
+		} else {
+			I64 rm = ra + (rb - ra) / 2;
+			block( xa, xb, ra, rm );
+			block( xa, xb, rm, rb );
+		}
+	};
+	block( x0, x1, r0, r1 );
+
+	// Stitch the runs into spans.  A span can only grow while every 
+	// aspect's tiles in it stay contiguous and keep the same flags.
+	std::sort( runs.begin(), runs.end(), []( const Run& a, const Run& b ) {
+		return (a.row < b.row) || ((a.row == b.row) && (a.begin < b.begin));
+	} );
+
+	for( const Run& run : runs ) {
+		bool extend = !spans.empty() && (spans.back().row == run.row)
+			&& (spans.back().end == run.begin);
+		size_t base = spans.size() - 1;
+		for( size_t asp = 0; extend && (asp < na); ++asp ) {
+			if( run.flags[asp] == 0 ) {
+				continue;
+			}
+			const I64 *r = &ranges[ 2*(base*na + asp) ];
+			if( (r[0] < r[1]) && ((r[1] != run.begin) 
+					|| (flags[base*na + asp] != run.flags[asp])) ) {
+				extend = false;
+			}
+		}
+
+		if( extend ) {
+			spans.back().end = run.end;
+		} else {
+			// Every span so far is complete, so this is the place to stop
+			// once they're over budget.
+			if( overBudget() ) {
+				break;
+			}
+			addSpan( run.row, run.begin, run.end );
+			for( size_t asp = 0; asp < na; ++asp ) {
+				ranges.push_back( 0 );
+				ranges.push_back( 0 );
+				flags.push_back( 0 );
+			}
+			base = spans.size() - 1;
+		}
+
+		for( size_t asp = 0; asp < na; ++asp ) {
+			if( run.flags[asp] == 0 ) {
+				continue;
+			}
+			I64 *r = &ranges[ 2*(base*na + asp) ];
+			if( r[0] == r[1] ) {
+				r[0] = run.begin;
+			}
+			r[1] = run.end;
+			flags[base*na + asp] = run.flags[asp];
+		}
+	}
+
+	if( debug ) {
+		cerr << "Mask fill: " << runs.size() << " runs, " 
+			<< spans.size() << " spans" << endl;
+	}
+}
+
+size_t FillAlgorithm::spanTiles( size_t sidx ) const
+{
+	size_t na = tiling.numAspects();
+
+	if( ranges.empty() ) {
+		return na * (spans[sidx].end - spans[sidx].begin);
+	}
+
+	size_t num = 0;
+	for( size_t asp = 0; asp < na; ++asp ) {
+		const I64 *r = &ranges[ 2*(sidx*na + asp) ];
+		num += r[1] - r[0];
+	}
+	return num;
+}
+
+bool FillAlgorithm::overBudget()
+{
+	for( ; tallied < spans.size(); ++tallied ) {
+		tally += spanTiles( tallied );
+	}
+	return tally > budget;
+}
+
+void FillAlgorithm::trim( size_t k )
+{
+	// Keep the first k tiles, rounded down to a whole lattice cell.
+	size_t na = tiling.numAspects();
+	size_t sidx = std::upper_bound( 
+		offsets.begin(), offsets.end(), k ) - offsets.begin() - 1;
+	size_t rem = k - offsets[sidx];
+	FillSpan& sp = spans[sidx];
+
+	I64 lo = sp.begin;
+	I64 hi = sp.end;
+	while( hi - lo > 1 ) {
+		I64 mid = lo + (hi - lo) / 2;
+		if( tilesBefore( sidx, mid ) <= rem ) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if( lo > sp.begin ) {
+		sp.end = lo;
+		if( !ranges.empty() ) {
+			for( size_t asp = 0; asp < na; ++asp ) {
+				I64 *r = &ranges[ 2*(sidx*na + asp) ];
+				r[1] = std::min( r[1], lo );
+				r[0] = std::min( r[0], r[1] );
+			}
+		}
+		++sidx;
+	}
+
+	spans.resize( sidx );
+	if( !ranges.empty() ) {
+		ranges.resize( 2*sidx*na );
+	}
+	if( !flags.empty() ) {
+		flags.resize( sidx*na );
+	}
+	computeOffsets();
+}
+
+void FillAlgorithm::computeOffsets()
+{
+	offsets.resize( spans.size() + 1 );
+	offsets[0] = 0;
+	for( size_t sidx = 0; sidx < spans.size(); ++sidx ) {
+		offsets[sidx+1] = offsets[sidx] + spanTiles( sidx );
+	}
+}
+
+bool FillAlgorithm::inRange( size_t span, I64 t1, size_t asp ) const
+{
+	if( ranges.empty() ) {
+		return true;
+	}
+
+	const I64 *r = &ranges[ 2*(span*tiling.numAspects() + asp) ];
+	return (t1 >= r[0]) && (t1 < r[1]);
+}
+
+size_t FillAlgorithm::tilesBefore( size_t span, I64 x ) const
+{
+	size_t na = tiling.numAspects();
+
+	if( ranges.empty() ) {
+		return na * (x - spans[span].begin);
+	}
+
+	size_t num = 0;
+	for( size_t asp = 0; asp < na; ++asp ) {
+		const I64 *r = &ranges[ 2*(span*na + asp) ];
+		num += std::max( I64( 0 ), std::min( x, r[1] ) - r[0] );
+	}
+	return num;
+}
+
+void FillAlgorithm::seek( FillRegionIterator& it, size_t k ) const
+{
+	if( k >= size() ) {
+		it.done = true;
+		it.index = size();
+		return;
+	}
+
+	size_t sidx = std::upper_bound( 
+		offsets.begin(), offsets.end(), k ) - offsets.begin() - 1;
+	size_t rem = k - offsets[sidx];
+	const FillSpan& sp = spans[sidx];
+
+	// Find the cell containing the tile: the last x with at most rem
+	// tiles before it in this row.
+	I64 lo = sp.begin;
+	I64 hi = sp.end;
+	if( ranges.empty() ) {
+		lo = sp.begin + I64(rem / tiling.numAspects());
+	} else {
+		while( hi - lo > 1 ) {
+			I64 mid = lo + (hi - lo) / 2;
+			if( tilesBefore( sidx, mid ) <= rem ) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+	}
+	rem -= tilesBefore( sidx, lo );
+
+	size_t asp = 0;
+	for( ;; ++asp ) {
+		if( inRange( sidx, lo, asp ) ) {
+			if( rem == 0 ) {
+				break;
+			}
+			--rem;
+		}
+	}
+
+	it.done = false;
+	it.index = k;
+	it.span_idx = sidx;
+	it.x = lo;
+	it.asp = asp;
+}
+
+FillRegionIterator FillAlgorithm::begin() const
+{
+	return (*this)[0];
+}
+
+FillRegionIterator FillAlgorithm::end() const
+{
+	return FillRegionIterator( *this );
+}
+
+bool FillAlgorithm::isTruncated() const
+{
+	return truncated;
+}
+
+void FillAlgorithm::retain( std::shared_ptr<const TilingGeometry> geom )
+{
+	retained = std::move( geom );
+}
+
+size_t FillAlgorithm::size() const
+{
+	return offsets.back();
+}
+
+FillRegionIterator FillAlgorithm::operator[]( size_t k ) const
+{
+	FillRegionIterator it( *this );
+	seek( it, k );
+	return it;
+}
+
+size_t FillAlgorithm::numSpans() const
+{
+	return spans.size();
+}
+
+const FillSpan& FillAlgorithm::getSpan( size_t idx ) const
+{
+	return spans[ idx ];
+}
+
+void FillAlgorithm::getAspectRange( 
+	size_t idx, U8 asp, I64& begin, I64& end ) const
+{
+	if( ranges.empty() ) {
+		begin = spans[ idx ].begin;
+		end = spans[ idx ].end;
+	} else {
+		begin = ranges[ 2*(idx*tiling.numAspects() + asp) ];
+		end = ranges[ 2*(idx*tiling.numAspects() + asp) + 1 ];
+	}
+}
+
+size_t FillAlgorithm::getSpanOffset( size_t idx ) const
+{
+	return offsets[ idx ];
+}
+
+const glm::ivec2& FillAlgorithm::getBasis( size_t idx ) const
+{
+	return basis[ idx ];
+}
+
+const glm::dvec2& FillAlgorithm::getBasisVector( size_t idx ) const
+{
+	return basis_vec[ idx ];
+}
+
+void FillAlgorithm::prepareEmit( 
+	const glm::dmat3& view, Emitter& em ) const
+{
+	size_t na = tiling.numAspects();
+	const glm::dvec2& t1 = basis_vec[0];
+	const glm::dvec2& t2 = basis_vec[1];
+
+	// Compose the view with every aspect once, and push the basis vectors
+	// through the linear part of the view, so that each tile costs two
+	// multiply-adds per coordinate.
+	for( size_t idx = 0; idx < na; ++idx ) {
+		em.VA[idx] = AffineXform( view ) * tiling.getAspectAffine( idx );
+	}
+	em.vt1 = glm::dvec2( view[0][0]*t1.x + view[1][0]*t1.y,
+		view[0][1]*t1.x + view[1][1]*t1.y );
+	em.vt2 = glm::dvec2( view[0][0]*t2.x + view[1][0]*t2.y,
+		view[0][1]*t2.x + view[1][1]*t2.y );
+
+	// getColour() depends only on the lattice coordinates mod the number
+	// of colours, so tabulate it rather than stepping the colouring
+	// permutations for every tile.
+	em.nc = tiling.colouring[18];
+	for( size_t idx = 0; idx < na; ++idx ) {
+		for( int m1 = 0; m1 < em.nc; ++m1 ) {
+			for( int m2 = 0; m2 < em.nc; ++m2 ) {
+				em.cols[idx][m1][m2] = tiling.getColour( m1, m2, idx );
+			}
+		}
+	}
+}
+
+template<typename T>
+inline void FillAlgorithm::writeTile( const Emitter& em, size_t sidx, 
+	size_t asp, I64 tx, I64 ty, int m1, int m2, double dx, double dy, 
+	const BasicFillBuffers<T>& out, size_t pos ) const
+{
+	if( out.t1 ) {
+		out.t1[pos] = tx;
+	}
+	if( out.t2 ) {
+		out.t2[pos] = ty;
+	}
+	if( out.aspect ) {
+		out.aspect[pos] = U8(asp);
+	}
+	if( out.colour ) {
+		out.colour[pos] = em.cols[asp][m1][m2];
+	}
+	if( out.flags ) {
+		out.flags[pos] = flags.empty() 
+			? 0 : flags[ sidx*tiling.numAspects() + asp ];
+	}
+	if( out.xform ) {
+		const AffineXform& M = em.VA[asp];
+		T *X = out.xform + 6*pos;
+		X[0] = T( M.col[0].x );
+		X[1] = T( M.col[0].y );
+		X[2] = T( M.col[1].x );
+		X[3] = T( M.col[1].y );
+		X[4] = T( M.col[2].x + dx );
+		X[5] = T( M.col[2].y + dy );
+	}
+}
+
+template<typename T>
+size_t FillAlgorithm::emitCells( const Emitter& em, size_t sidx, 
+	I64 xbegin, I64 xend, const BasicFillBuffers<T>& out, size_t count, 
+	size_t first_asp ) const
 {
-	return FillRegionIterator( *this );
+	size_t na = tiling.numAspects();
+	int nc = em.nc;
+
+	// Positions are taken relative to the origin cell, with the integer
+	// part of the difference done exactly.
+	const FillSpan& sp = spans[sidx];
+	double ox = double( sp.row - origin_cell[1] )*em.vt2.x;
+	double oy = double( sp.row - origin_cell[1] )*em.vt2.y;
+
+	for( I64 x = xbegin; x < xend; ++x ) {
+		// Convert back to the tiling's own lattice coordinates.
+		I64 tx = x*basis[0].x + sp.row*basis[1].x;
+		I64 ty = x*basis[0].y + sp.row*basis[1].y;
+		int m1 = int( tx % nc );
+		if( m1 < 0 ) {
+			m1 += nc;
+		}
+		int m2 = int( ty % nc );
+		if( m2 < 0 ) {
+			m2 += nc;
+		}
+		double dx = ox + double( x - origin_cell[0] )*em.vt1.x;
+		double dy = oy + double( x - origin_cell[0] )*em.vt1.y;
+
+		for( size_t asp = (x == xbegin) ? first_asp : 0; asp < na; ++asp ) {
+			if( !inRange( sidx, x, asp ) ) {
+				continue;
+			}
+			if( count == out.capacity ) {
+				return count;
+			}
+			writeTile( em, sidx, asp, tx, ty, m1, m2, dx, dy, out, count );
+			++count;
+		}
+	}
+
+	return count;
+}
+
+template<typename T>
+size_t FillAlgorithm::emitSpans( const Emitter& em, 
+	size_t first, size_t last, const BasicFillBuffers<T>& out, 
+	size_t count ) const
+{
+	for( size_t sidx = first; sidx < last; ++sidx ) {
+		count = emitCells( em, sidx, 
+			spans[sidx].begin, spans[sidx].end, out, count );
+	}
+
+	return count;
+}
+
+template<typename T>
+size_t FillAlgorithm::fillInto( 
+	const glm::dmat3& view, const BasicFillBuffers<T>& out ) const
+{
+	Emitter em;
+	prepareEmit( view, em );
+	return emitSpans( em, 0, spans.size(), out, 0 );
+}
+
+template<typename T>
+size_t FillAlgorithm::fillInto( const glm::dmat3& view, 
+	const BasicFillBuffers<T>& out, size_t first ) const
+{
+	FillRegionIterator it( *this );
+	seek( it, first );
+	if( it.done ) {
+		return 0;
+	}
+
+	Emitter em;
+	prepareEmit( view, em );
+	// Finish the row from the first tile on, then carry on as usual.
+	size_t count = emitCells( em, it.span_idx, 
+		it.x, spans[it.span_idx].end, out, 0, it.asp );
+	return emitSpans( em, it.span_idx + 1, spans.size(), out, count );
+}
+
+template<typename T>
+size_t FillAlgorithm::fillIntoParallel( const glm::dmat3& view, 
+	const BasicFillBuffers<T>& out, size_t num_threads ) const
+{
+	size_t total = std::min( offsets.back(), out.capacity );
+
+	if( num_threads == 0 ) {
+		num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+	}
+	// Not worth waking anybody up for a small fill.
+	if( (num_threads == 1) || (total < 4096) ) {
+		return fillInto( view, out );
+	}
+
+	Emitter em;
+	prepareEmit( view, em );
+
+	// Cut the rows into a few units of work per thread, with roughly equal
+	// numbers of tiles in each.  Every unit knows from the prefix sums
+	// where its first tile belongs in the output, so the result is the
+	// same as a serial fill no matter which thread runs which unit.
+	size_t num_units = 4*num_threads;
+	std::vector<size_t> cuts( 1, 0 );
+	for( size_t idx = 1; idx < num_units; ++idx ) {
+		size_t target = (total * idx) / num_units;
+		size_t sidx = std::upper_bound( 
+			offsets.begin(), offsets.end(), target ) - offsets.begin() - 1;
+		if( sidx > cuts.back() ) {
+			cuts.push_back( sidx );
+		}
+	}
+	cuts.push_back( spans.size() );
+
+	std::atomic<size_t> next( 0 );
+	auto worker = [&]() {
+		for( size_t unit = next++; unit + 1 < cuts.size(); unit = next++ ) {
+			size_t start = offsets[cuts[unit]];
+			if( start < out.capacity ) {
+				emitSpans( em, cuts[unit], cuts[unit+1], out, start );
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for( size_t idx = 1; idx < num_threads; ++idx ) {
+		pool.push_back( std::thread( worker ) );
+	}
+	worker();
+	for( auto& th : pool ) {
+		th.join();
+	}
+
+	return total;
+}
+
+template<typename T>
+size_t FillAlgorithm::fillIntoOrdered( const glm::dmat3& view, 
+	const BasicFillBuffers<T>& out, FillOrder order, int block_size ) const
+{
+	if( (order == ROW_ORDER) || spans.empty() ) {
+		return fillInto( view, out );
+	}
+
+	// Lay a grid of blocks over the fill's cells, and record which spans
+	// fall in each row of blocks and which columns of blocks they reach.
+	// Spans are sorted by row, so each row of blocks gets a contiguous
+	// run of them.
+	int bs = std::max( 1, block_size );
+	I64 row0 = spans.front().row;
+	I64 x0 = spans.front().begin;
+	for( const FillSpan& sp : spans ) {
+		x0 = std::min( x0, sp.begin );
+	}
+	int nby = int( (spans.back().row - row0) / bs ) + 1;
+
+	std::vector<size_t> first( nby + 1, spans.size() );
+	std::vector<int> lo( nby, std::numeric_limits<int>::max() );
+	std::vector<int> hi( nby, -1 );
+	int nb = nby;
+	for( size_t sidx = spans.size(); sidx-- > 0; ) {
+		const FillSpan& sp = spans[sidx];
+		int by = int( (sp.row - row0) / bs );
+		first[by] = sidx;
+		lo[by] = std::min( lo[by], int( (sp.begin - x0) / bs ) );
+		hi[by] = std::max( hi[by], int( (sp.end - 1 - x0) / bs ) );
+		nb = std::max( nb, hi[by] + 1 );
+	}
+	for( int by = nby; by-- > 0; ) {
+		first[by] = std::min( first[by], first[by+1] );
+	}
+
+	// Walk a square grid of a power-of-two size along the chosen curve,
+	// skipping any sub-square that no span touches.
+	struct Curve {
+		const FillAlgorithm& algo;
+		const Emitter& em;
+		const BasicFillBuffers<T>& out;
+		int bs;
+		I64 x0;
+		int nby;
+		const std::vector<size_t>& first;
+		const std::vector<int>& lo;
+		const std::vector<int>& hi;
+		size_t count;
+
+		// Is the inclusive rectangle of blocks free of cells?
+		bool empty( int bx0, int by0, int bx1, int by1 ) const
+		{
+			for( int by = std::max( by0, 0 ); by <= std::min( by1, nby-1 ); ++by ) {
+				if( (lo[by] <= bx1) && (hi[by] >= bx0) ) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void block( int bx, int by )
+		{
+			I64 xb = x0 + I64( bx )*bs;
+			I64 xe = xb + bs;
+			for( size_t sidx = first[by]; sidx < first[by+1]; ++sidx ) {
+				const FillSpan& sp = algo.spans[sidx];
+				I64 b = std::max( sp.begin, xb );
+				I64 e = std::min( sp.end, xe );
+				if( b < e ) {
+					count = algo.emitCells( em, sidx, b, e, out, count );
+				}
+			}
+		}
+
+		void morton( int bx, int by, int sz )
+		{
+			if( (count == out.capacity) 
+					|| empty( bx, by, bx + sz - 1, by + sz - 1 ) ) {
+				return;
+			}
+			if( sz == 1 ) {
+				block( bx, by );
+				return;
+			}
+
+			int h = sz / 2;
+			morton( bx, by, h );
+			morton( bx + h, by, h );
+			morton( bx, by + h, h );
+			morton( bx + h, by + h, h );
+		}
+
+		// The square of blocks (cx, cy) + i*(ux, uy) + j*(vx, vy), for i
+		// and j in [0, sz), where u and v are unit axis vectors.
+		void hilbert( int cx, int cy, 
+			int ux, int uy, int vx, int vy, int sz )
+		{
+			int ex = cx + (sz-1)*(ux+vx);
+			int ey = cy + (sz-1)*(uy+vy);
+			if( (count == out.capacity) || empty( std::min( cx, ex ), 
+					std::min( cy, ey ), std::max( cx, ex ), 
+					std::max( cy, ey ) ) ) {
+				return;
+			}
+			if( sz == 1 ) {
+				block( cx, cy );
+				return;
+			}
+
+			int h = sz / 2;
+			hilbert( cx, cy, vx, vy, ux, uy, h );
+			hilbert( cx + h*ux, cy + h*uy, ux, uy, vx, vy, h );
+			hilbert( cx + h*(ux+vx), cy + h*(uy+vy), ux, uy, vx, vy, h );
+			hilbert( cx + (h-1)*ux + (sz-1)*vx, cy + (h-1)*uy + (sz-1)*vy,
+				-vx, -vy, -ux, -uy, h );
+		}
+	};
+
+	Emitter em;
+	prepareEmit( view, em );
+
+	Curve curve = { *this, em, out, bs, x0, nby, first, lo, hi, 0 };
+	int sz = 1;
+	while( sz < nb ) {
+		sz *= 2;
+	}
+	if( order == MORTON_ORDER ) {
+		curve.morton( 0, 0, sz );
+	} else {
+		curve.hilbert( 0, 0, 1, 0, 0, 1, sz );
+	}
+
+	return curve.count;
+}
+
+FillViewport::FillViewport( const IsohedralTiling& t )
+	: tiling( t )
+{
+	reset();
+}
+
+void FillViewport::update( 
+	double xmin, double ymin, double xmax, double ymax )
+{
+	update( 
+		glm::dvec2( xmin, ymin ), glm::dvec2( xmax, ymin ),
+		glm::dvec2( xmax, ymax ), glm::dvec2( xmin, ymax ) );
+}
+
+void FillViewport::update( const glm::dvec2& A, const glm::dvec2& B, 
+	const glm::dvec2& C, const glm::dvec2& D )
+{
+	FillAlgorithm fill( tiling, basis[0], basis[1], A, B, C, D );
+	subtractSpans( fill.spans, current, entered );
+	subtractSpans( current, fill.spans, left );
+	current.swap( fill.spans );
+}
+
+void FillViewport::reset()
+{
+	// The cells are those of the approximate fill, in the same basis.
+	FillAlgorithm::reduceBasis( tiling, basis );
+	current.clear();
+	entered.clear();
+	left.clear();
+}
+
+FillAlgorithm FillViewport::getCurrent() const
+{
+	return FillAlgorithm( tiling, basis[0], basis[1], current );
+}
+
+FillAlgorithm FillViewport::getEntered() const
+{
+	return FillAlgorithm( tiling, basis[0], basis[1], entered );
+}
+
+FillAlgorithm FillViewport::getLeft() const
+{
+	return FillAlgorithm( tiling, basis[0], basis[1], left );
+}
+
+void FillViewport::subtractSpans( const std::vector<FillSpan>& a, 
+	const std::vector<FillSpan>& b, std::vector<FillSpan>& out )
+{
+	// Both lists are sorted by row, and by position within a row, with
+	// no overlaps.  Cut each span of a around the spans of b in its row.
+	out.clear();
+
+	size_t j = 0;
+	for( const FillSpan& sp : a ) {
+		while( (j < b.size()) && ((b[j].row < sp.row) 
+				|| ((b[j].row == sp.row) && (b[j].end <= sp.begin))) ) {
+			++j;
+		}
+
+		FillSpan piece = sp;
+		for( size_t k = j; (k < b.size()) && (b[k].row == sp.row) 
+				&& (b[k].begin < sp.end); ++k ) {
+			if( b[k].begin > piece.begin ) {
+				piece.end = b[k].begin;
+				out.push_back( piece );
+			}
+			piece.begin = std::max( piece.begin, b[k].end );
+		}
+		if( piece.begin < sp.end ) {
+			piece.end = sp.end;
+			out.push_back( piece );
+		}
+	}
+}
+
+template<typename T>
+size_t FillAlgorithm::fillIntoGroups( const glm::dmat3& view, 
+	const BasicFillBuffers<T>& out, FillGrouping grouping, 
+	std::vector<size_t>& group_offsets, unsigned keep ) const
+{
+	Emitter em;
+	prepareEmit( view, em );
+
+	size_t na = tiling.numAspects();
+	int nc = em.nc;
+	size_t ng = (grouping == GROUP_BY_COLOUR) ? size_t( nc ) : na;
+
+	auto mod = [nc]( I64 v ) {
+		int m = int( v % nc );
+		return (m < 0) ? (m + nc) : m;
+	};
+
+	// Walk the tiles of every kept group, a span and an aspect at a time.
+	// The colour of a cell depends only on its position mod nc, so when
+	// grouping by colour, step through each residue class of a span's 
+	// cells separately, and skip the classes whose colour isn't kept.  
+	// The first pass counts, the second writes.
+	std::vector<size_t> cursor( ng, 0 );
+	auto walk = [&]( bool write ) {
+		for( size_t sidx = 0; sidx < spans.size(); ++sidx ) {
+			const FillSpan& sp = spans[sidx];
+			I64 rx = sp.row*basis[1].x;
+			I64 ry = sp.row*basis[1].y;
+			double ox = double( sp.row - origin_cell[1] )*em.vt2.x;
+			double oy = double( sp.row - origin_cell[1] )*em.vt2.y;
+
+			for( size_t asp = 0; asp < na; ++asp ) {
+				if( (grouping == GROUP_BY_ASPECT) && !(keep & (1u << asp)) ) {
+					continue;
+				}
+
+				I64 b;
+				I64 e;
+				getAspectRange( sidx, U8(asp), b, e );
+				int classes = (grouping == GROUP_BY_COLOUR) ? nc : 1;
+
+				for( int r = 0; r < classes; ++r ) {
+					I64 x0 = b;
+					I64 step = 1;
+					size_t g = asp;
+					if( grouping == GROUP_BY_COLOUR ) {
+						x0 = b + mod( r - b );
+						step = nc;
+						g = em.cols[asp][mod( r*basis[0].x + rx )]
+							[mod( r*basis[0].y + ry )];
+						if( !(keep & (1u << g)) ) {
+							continue;
+						}
+					}
+					if( x0 >= e ) {
+						continue;
+					}
+
+					if( !write ) {
+						cursor[g] += size_t( (e - x0 + step - 1) / step );
+						continue;
+					}
+
+					for( I64 x = x0; x < e; x += step ) {
+						if( cursor[g] == group_offsets[g+1] ) {
+							break;
+						}
+						I64 tx = x*basis[0].x + rx;
+						I64 ty = x*basis[0].y + ry;
+						double dx = ox + double( x - origin_cell[0] )*em.vt1.x;
+						double dy = oy + double( x - origin_cell[0] )*em.vt1.y;
+						writeTile( em, sidx, asp, tx, ty, mod( tx ), mod( ty ), 
+							dx, dy, out, cursor[g]++ );
+					}
+				}
+			}
+		}
+	};
+
+	walk( false );
+
+	// Lay the groups out back to back, cutting them off at the capacity.
+	group_offsets.assign( ng + 1, 0 );
+	for( size_t g = 0; g < ng; ++g ) {
+		group_offsets[g+1] = std::min( 
+			group_offsets[g] + cursor[g], out.capacity );
+		cursor[g] = group_offsets[g];
+	}
+
+	walk( true );
+	return group_offsets[ng];
+}
+
+template size_t FillAlgorithm::fillInto( 
+	const glm::dmat3&, const FillBuffers& ) const;
+template size_t FillAlgorithm::fillInto( 
+	const glm::dmat3&, const FloatFillBuffers& ) const;
+template size_t FillAlgorithm::fillInto( 
+	const glm::dmat3&, const FillBuffers&, size_t ) const;
+template size_t FillAlgorithm::fillInto( 
+	const glm::dmat3&, const FloatFillBuffers&, size_t ) const;
+template size_t FillAlgorithm::fillIntoParallel( 
+	const glm::dmat3&, const FillBuffers&, size_t ) const;
+template size_t FillAlgorithm::fillIntoParallel( 
+	const glm::dmat3&, const FloatFillBuffers&, size_t ) const;
+template size_t FillAlgorithm::fillIntoOrdered( 
+	const glm::dmat3&, const FillBuffers&, FillOrder, int ) const;
+template size_t FillAlgorithm::fillIntoOrdered( 
+	const glm::dmat3&, const FloatFillBuffers&, FillOrder, int ) const;
+template size_t FillAlgorithm::fillIntoGroups( 
+	const glm::dmat3&, const FillBuffers&, FillGrouping, 
+	std::vector<size_t>&, unsigned ) const;
+template size_t FillAlgorithm::fillIntoGroups( 
+	const glm::dmat3&, const FloatFillBuffers&, FillGrouping, 
+	std::vector<size_t>&, unsigned ) const;
+
+FillMask::FillMask( const U8 *pixels, int w, int h, 
+		const glm::dmat3& tw )
+	: width( w )
+	, height( h )
+	, to_world( tw )
+	, from_world( glm::inverse( tw ) )
+{
+	lo.push_back( std::vector<U8>( size_t( w ) * h ) );
+	for( size_t idx = 0; idx < lo[0].size(); ++idx ) {
+		lo[0][idx] = (pixels[idx] != 0) ? 1 : 0;
+	}
+	hi.push_back( lo[0] );
+	level_width.push_back( w );
+	level_height.push_back( h );
+
+	// Halve the resolution until one block covers the whole mask.  Blocks
+	// hanging off the edge take the min and max of the pixels they have.
+	while( (level_width.back() > 1) || (level_height.back() > 1) ) {
+		size_t k = lo.size() - 1;
+		int pw = level_width[k];
+		int ph = level_height[k];
+		int nw = (pw + 1) / 2;
+		int nh = (ph + 1) / 2;
+
+		std::vector<U8> nlo( size_t( nw ) * nh, 1 );
+		std::vector<U8> nhi( size_t( nw ) * nh, 0 );
+		for( int j = 0; j < ph; ++j ) {
+			for( int i = 0; i < pw; ++i ) {
+				size_t src = size_t( j ) * pw + i;
+				size_t dst = size_t( j / 2 ) * nw + i / 2;
+				nlo[dst] = std::min( nlo[dst], lo[k][src] );
+				nhi[dst] = std::max( nhi[dst], hi[k][src] );
+			}
+		}
+
+		lo.push_back( nlo );
+		hi.push_back( nhi );
+		level_width.push_back( nw );
+		level_height.push_back( nh );
+	}
+}
+
+U8 FillMask::coverage( const glm::dvec2& blo, const glm::dvec2& bhi ) const
+{
+	if( (width <= 0) || (height <= 0) ) {
+		return 0;
+	}
+
+	// The pixels whose interiors meet the box, or the one it sits in if
+	// it has no width.
+	double fi0 = floor( blo.x );
+	double fj0 = floor( blo.y );
+	double fi1 = std::max( fi0, ceil( bhi.x ) - 1.0 );
+	double fj1 = std::max( fj0, ceil( bhi.y ) - 1.0 );
+	if( (fi1 < 0.0) || (fj1 < 0.0) || (fi0 >= width) || (fj0 >= height) ) {
+		return 0;
+	}
+
+	bool outside = (fi0 < 0.0) || (fj0 < 0.0) 
+		|| (fi1 >= width) || (fj1 >= height);
+	int i0 = int( std::max( fi0, 0.0 ) );
+	int j0 = int( std::max( fj0, 0.0 ) );
+	int i1 = int( std::min( fi1, double( width - 1 ) ) );
+	int j1 = int( std::min( fj1, double( height - 1 ) ) );
+
+	bool any = false;
+	bool all = true;
+	visit( lo.size() - 1, 0, 0, i0, j0, i1, j1, any, all );
+
+	if( !any ) {
+		return 0;
+	}
+	return (all && !outside) ? U8( INSIDE_MASK ) : U8( ON_MASK_BOUNDARY );
+}
+
+void FillMask::visit( size_t level, int i, int j, 
+	int i0, int j0, int i1, int j1, bool& any, bool& all ) const
+{
+	if( (i >= level_width[level]) || (j >= level_height[level]) ) {
+		return;
+	}
+
+	// Skip blocks that miss the query.
+	int bi0 = i << level;
+	int bj0 = j << level;
+	int bi1 = ((i + 1) << level) - 1;
+	int bj1 = ((j + 1) << level) - 1;
+	if( (bi1 < i0) || (bi0 > i1) || (bj1 < j0) || (bj0 > j1) ) {
+		return;
+	}
+
+	size_t idx = size_t( j ) * level_width[level] + i;
+	if( lo[level][idx] ) {
+		any = true;
+		return;
+	}
+	if( !hi[level][idx] ) {
+		all = false;
+		return;
+	}
+
+	for( int dj = 0; dj < 2; ++dj ) {
+		for( int di = 0; di < 2; ++di ) {
+			if( any && !all ) {
+				return;
+			}
+			visit( level - 1, 2*i + di, 2*j + dj, i0, j0, i1, j1, any, all );
+		}
+	}
+}
+
+std::string FillCursor::toString() const
+{
+	std::ostringstream out;
+	out << index << ' ' << t1 << ' ' << t2 << ' ' << int( aspect );
+	return out.str();
+}
+
+bool FillCursor::fromString( const std::string& str )
+{
+	std::istringstream in( str );
+	FillCursor c;
+	int asp;
+	in >> c.index >> c.t1 >> c.t2 >> asp;
+	if( in.fail() || (asp < 0) || (asp > 255) ) {
+		return false;
+	}
+	c.aspect = U8( asp );
+	*this = c;
+	return true;
+}
+
+FillStream::FillStream( const FillAlgorithm& f, const glm::dmat3& v,
+		size_t bsize, size_t rsize )
+	: fill( f )
+	, view( v )
+	, batch_size( std::max( bsize, size_t( 1 ) ) )
+	, ring( std::max( rsize, size_t( 1 ) ) )
+	, head( 0 )
+	, tail( 0 )
+	, produced( 0 )
+	, position( 0 )
+	, stopping( false )
+{}
+
+FillStream::~FillStream()
+{
+	stop();
+}
+
+void FillStream::produce()
+{
+	size_t total = fill.size();
+	std::unique_lock<std::mutex> lk( lock );
+
+	while( produced < total ) {
+		cv.wait( lk, [this] { 
+			return stopping || (tail - head < ring.size()); } );
+		if( stopping ) {
+			return;
+		}
+
+		// The slot at tail is the producer's until tail moves past it, so
+		// it can be filled without holding the lock.
+		FillChunk& chunk = ring[tail % ring.size()];
+		size_t first = produced;
+		size_t n = std::min( batch_size, total - first );
+		lk.unlock();
+
+		chunk.first = first;
+		chunk.t1.resize( n );
+		chunk.t2.resize( n );
+		chunk.aspect.resize( n );
+		chunk.colour.resize( n );
+		chunk.flags.resize( n );
+		chunk.xform.resize( 6 * n );
+
+		FillBuffers out;
+		out.t1 = chunk.t1.data();
+		out.t2 = chunk.t2.data();
+		out.aspect = chunk.aspect.data();
+		out.colour = chunk.colour.data();
+		out.flags = chunk.flags.data();
+		out.xform = chunk.xform.data();
+		out.capacity = n;
+		fill.fillInto( view, out, first );
+
+		lk.lock();
+		produced = first + n;
+		++tail;
+		cv.notify_all();
+	}
+}
+
+void FillStream::stop()
+{
+	{
+		std::lock_guard<std::mutex> lk( lock );
+		stopping = true;
+	}
+	cv.notify_all();
+	if( producer.joinable() ) {
+		producer.join();
+	}
+
+	// Throw away anything produced ahead of the consumer.
+	head = 0;
+	tail = 0;
+	produced = position;
+	stopping = false;
+}
+
+bool FillStream::next( FillChunk& chunk )
+{
+	if( position >= fill.size() ) {
+		return false;
+	}
+	if( !producer.joinable() ) {
+		producer = std::thread( &FillStream::produce, this );
+	}
+
+	std::unique_lock<std::mutex> lk( lock );
+	cv.wait( lk, [this] { return head != tail; } );
+	std::swap( chunk, ring[head % ring.size()] );
+	++head;
+	position = chunk.first + chunk.size();
+	lk.unlock();
+	cv.notify_all();
+
+	return true;
+}
+
+FillCursor FillStream::cursorAt( size_t k ) const
+{
+	FillCursor c;
+	c.index = k;
+	if( k < fill.size() ) {
+		FillRegionIterator it = fill[k];
+		c.t1 = it.getT1();
+		c.t2 = it.getT2();
+		c.aspect = U8( it.getAspect() );
+	}
+	return c;
+}
+
+FillCursor FillStream::getCursor() const
+{
+	return cursorAt( position );
+}
+
+bool FillStream::seek( const FillCursor& cursor )
+{
+	if( cursor.index > fill.size() ) {
+		return false;
+	}
+	FillCursor c = cursorAt( cursor.index );
+	if( (c.t1 != cursor.t1) || (c.t2 != cursor.t2) 
+			|| (c.aspect != cursor.aspect) ) {
+		return false;
+	}
+
+	stop();
+	position = cursor.index;
+	produced = position;
+	return true;
+}
+
+// Chunks in a stream file are a header (chunk_head, tile count, index of
+// the first tile), the arrays of a FillChunk, and a trailer (chunk_tail
+// and the cursor after the chunk).
+static const char chunk_head[4] = { 'T', 'F', 'C', 'H' };
+static const char chunk_tail[4] = { 'T', 'F', 'C', 'T' };
+static const size_t chunk_tile_bytes = 
+	2*sizeof( I64 ) + 3*sizeof( U8 ) + 6*sizeof( double );
+
+template<typename T>
+static void putRaw( std::ostream& out, const T *data, size_t n )
+{
+	out.write( reinterpret_cast<const char *>( data ), 
+		std::streamsize( n * sizeof( T ) ) );
+}
+
+template<typename T>
+static bool getRaw( std::istream& in, T *data, size_t n )
+{
+	in.read( reinterpret_cast<char *>( data ), 
+		std::streamsize( n * sizeof( T ) ) );
+	return !in.fail();
+}
+
+static bool getChunkHead( std::istream& in, 
+	std::uint64_t& first, std::uint64_t& n )
+{
+	char magic[4];
+	return getRaw( in, magic, 4 ) 
+		&& (std::memcmp( magic, chunk_head, 4 ) == 0)
+		&& getRaw( in, &first, 1 ) && getRaw( in, &n, 1 );
+}
+
+static bool getChunkTail( std::istream& in, 
+	std::uint64_t end, FillCursor& after )
+{
+	char magic[4];
+	std::uint64_t index;
+	I64 t1;
+	I64 t2;
+	U8 asp;
+	if( !getRaw( in, magic, 4 ) 
+			|| (std::memcmp( magic, chunk_tail, 4 ) != 0)
+			|| !getRaw( in, &index, 1 ) || (index != end)
+			|| !getRaw( in, &t1, 1 ) || !getRaw( in, &t2, 1 )
+			|| !getRaw( in, &asp, 1 ) ) {
+		return false;
+	}
+
+	after.index = size_t( index );
+	after.t1 = t1;
+	after.t2 = t2;
+	after.aspect = asp;
+	return true;
+}
+
+void FillStream::writeChunk( std::ostream& out, 
+	const FillChunk& chunk, const FillCursor& after )
+{
+	std::uint64_t first = chunk.first;
+	std::uint64_t n = chunk.size();
+	std::uint64_t index = after.index;
+
+	putRaw( out, chunk_head, 4 );
+	putRaw( out, &first, 1 );
+	putRaw( out, &n, 1 );
+	putRaw( out, chunk.t1.data(), n );
+	putRaw( out, chunk.t2.data(), n );
+	putRaw( out, chunk.aspect.data(), n );
+	putRaw( out, chunk.colour.data(), n );
+	putRaw( out, chunk.flags.data(), n );
+	putRaw( out, chunk.xform.data(), 6 * n );
+	putRaw( out, chunk_tail, 4 );
+	putRaw( out, &index, 1 );
+	putRaw( out, &after.t1, 1 );
+	putRaw( out, &after.t2, 1 );
+	putRaw( out, &after.aspect, 1 );
+}
+
+bool FillStream::readChunk( std::istream& in, 
+	FillChunk& chunk, FillCursor& after )
+{
+	std::uint64_t first;
+	std::uint64_t n;
+	if( !getChunkHead( in, first, n ) ) {
+		return false;
+	}
+
+	chunk.first = size_t( first );
+	chunk.t1.resize( n );
+	chunk.t2.resize( n );
+	chunk.aspect.resize( n );
+	chunk.colour.resize( n );
+	chunk.flags.resize( n );
+	chunk.xform.resize( 6 * n );
+
+	return getRaw( in, chunk.t1.data(), n )
+		&& getRaw( in, chunk.t2.data(), n )
+		&& getRaw( in, chunk.aspect.data(), n )
+		&& getRaw( in, chunk.colour.data(), n )
+		&& getRaw( in, chunk.flags.data(), n )
+		&& getRaw( in, chunk.xform.data(), 6 * n )
+		&& getChunkTail( in, first + n, after );
+}
+
+bool FillStream::skipChunk( std::istream& in, FillCursor& after )
+{
+	std::uint64_t first;
+	std::uint64_t n;
+	if( !getChunkHead( in, first, n ) ) {
+		return false;
+	}
+	in.seekg( std::streamoff( n * chunk_tile_bytes ), std::ios::cur );
+	return !in.fail() && getChunkTail( in, first + n, after );
+}
+
+// Cut the file at path down to size bytes.  The standard library before
+// C++17 has no way to shrink a file in place.
+static bool truncateFile( const std::string& path, std::streamoff size )
+{
+#ifdef _WIN32
+	int fd;
+	if( _sopen_s( &fd, path.c_str(), _O_RDWR | _O_BINARY, 
+			_SH_DENYNO, 0 ) != 0 ) {
+		return false;
+	}
+	bool ok = (_chsize_s( fd, size ) == 0);
+	_close( fd );
+	return ok;
+#else
+	return ::truncate( path.c_str(), off_t( size ) ) == 0;
+#endif
+}
+
+bool FillStream::appendToFile( const std::string& path, size_t max_batches )
+{
+	std::ios::openmode mode = 
+		std::ios::in | std::ios::out | std::ios::binary;
+	std::fstream file( path.c_str(), mode );
+	if( !file.is_open() ) {
+		// Create the file, then open it for update as before.
+		std::ofstream( path.c_str(), std::ios::binary );
+		file.open( path.c_str(), mode );
+		if( !file.is_open() ) {
+			return false;
+		}
+	}
+
+	// Find the end of the last complete chunk, reading only headers and
+	// trailers.
+	std::streamoff end = 0;
+	bool resume = false;
+	FillCursor after;
+	while( skipChunk( file, after ) ) {
+		end = file.tellg();
+		resume = true;
+	}
+	file.clear();
+	if( resume && !seek( after ) ) {
+		return false;
+	}
+
+	// Drop whatever follows, so that a chunk left incomplete can't
+	// outlast the new ones written over it.
+	file.seekg( 0, std::ios::end );
+	if( std::streamoff( file.tellg() ) > end ) {
+		file.close();
+		if( !truncateFile( path, end ) ) {
+			return false;
+		}
+		file.open( path.c_str(), mode );
+		if( !file.is_open() ) {
+			return false;
+		}
+	}
+	file.seekp( end );
+
+	FillChunk chunk;
+	for( size_t b = 0; (max_batches == 0) || (b < max_batches); ++b ) {
+		if( !next( chunk ) ) {
+			break;
+		}
+		writeChunk( file, chunk, getCursor() );
+		file.flush();
+		if( file.fail() ) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
-const static glm::dmat3 TSPI_U[] = {
-	glm::dmat3( 0.5, 0.0, 0.0,  0.0, 0.5, 0.0,  0.0, 0.0, 1.0 ),
-	glm::dmat3( -0.5, 0.0, 0.0,  0.0, 0.5, 0.0,  1.0, 0.0, 1.0 )
+const static AffineXform TSPI_U[] = {
+	AffineXform( glm::dvec2( 0.5, 0.0 ), glm::dvec2( 0.0, 0.5 ), 
+		glm::dvec2( 0.0, 0.0 ) ),
+	AffineXform( glm::dvec2( -0.5, 0.0 ), glm::dvec2( 0.0, 0.5 ), 
+		glm::dvec2( 1.0, 0.0 ) )
 };
 
-const static glm::dmat3 TSPI_S[] = {
-	glm::dmat3( 0.5, 0.0, 0.0,  0.0, 0.5, 0.0,  0.0, 0.0, 1.0 ),
-	glm::dmat3( -0.5, 0.0, 0.0,  0.0, -0.5, 0.0,  1.0, 0.0, 1.0 )
+const static AffineXform TSPI_S[] = {
+	AffineXform( glm::dvec2( 0.5, 0.0 ), glm::dvec2( 0.0, 0.5 ), 
+		glm::dvec2( 0.0, 0.0 ) ),
+	AffineXform( glm::dvec2( -0.5, 0.0 ), glm::dvec2( 0.0, -0.5 ), 
+		glm::dvec2( 1.0, 0.0 ) )
 };
 
 TileShapePartIterator::TileShapePartIterator( 
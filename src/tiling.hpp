@@ -1,6 +1,15 @@
 #ifndef __TILING_HPP__
 #define __TILING_HPP__
 
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <glm/glm.hpp>
 
 namespace csk {
@@ -9,13 +18,21 @@ typedef unsigned char U8;
 
 typedef U8 TilingType;
 typedef U8 EdgeID;
+// Lattice indices of tiles in a fill.
+typedef std::int64_t I64;
 
 class IsohedralTiling;
 class TileShapeIterator;
 class TileShapePartIterator;
 class FillRegionIterator;
 class FillAlgorithm;
+class FillViewport;
+class FillMask;
+class FillStream;
+class TilingGeometry;
+class SharedTiling;
 class TilingVertexProxy;
+template<TilingType IH> class StaticIsohedralTiling;
 
 enum EdgeShape
 {
@@ -38,15 +55,186 @@ struct TilingTypeData {
 	const U8		*colouring;
 };
 
+// A 2D affine transformation, stored as the top two rows of a 
+// glm::dmat3 whose bottom row is (0, 0, 1): col[0] and col[1] are the
+// images of the x and y axes, and col[2] is the translation.  The
+// library keeps and composes its transforms in this form, which saves
+// a third of the storage and arithmetic; the getTransform() functions
+// convert to glm::dmat3 for you, and the getAffine() functions don't.
+struct AffineXform {
+	AffineXform();
+	AffineXform( const glm::dvec2& c0, const glm::dvec2& c1, 
+		const glm::dvec2& c2 );
+	// Ignores the bottom row of M.
+	explicit AffineXform( const glm::dmat3& M );
+
+	glm::dmat3 toMat3() const;
+
+	// Transform a point.
+	glm::dvec2 operator *( const glm::dvec2& p ) const;
+	AffineXform operator *( const AffineXform& other ) const;
+
+	glm::dvec2		col[3];
+};
+
 const size_t num_types = 81;
 extern const U8 tiling_types[81];
 
+// Caller-owned, structure-of-arrays destination for bulk region fills.
+// Every array must have room for at least capacity entries (six values
+// per entry for xform).  Any pointer may be left null, in which case
+// that attribute isn't written.  Each transform is the 2x3 affine part
+// of a glm::dmat3, stored column by column: (a, b, c, d, e, f) maps
+// (x, y) to (a*x + c*y + e, b*x + d*y + f).  Lattice indices are the
+// tiles' true ones, as from FillRegionIterator, but transforms are 
+// relative to the fill's origin cell (see FillOptions).  Flags are as
+// for FillRegionIterator::getFlags().
+//
+// Transforms can be written as doubles (FillBuffers) or floats 
+// (FloatFillBuffers).  Either way they're computed in double precision
+// and rounded once, on the way out.
+template<typename T>
+struct BasicFillBuffers {
+	BasicFillBuffers();
+
+	I64				*t1;
+	I64				*t2;
+	U8				*aspect;
+	U8				*colour;
+	U8				*flags;
+	T				*xform;
+	size_t			capacity;
+};
+
+typedef BasicFillBuffers<double> FillBuffers;
+typedef BasicFillBuffers<float> FloatFillBuffers;
+
+// Caller-owned, structure-of-arrays destination for 
+// IsohedralTiling::computeBatch().  Each array holds, coordinate after
+// coordinate, a run of n values (one per parameter set) for every
+// coordinate it covers: vertices has 2*numVertices() runs (x, then y, of
+// each vertex in turn), translations has four (T1.x, T1.y, T2.x, T2.y),
+// and aspects has six per aspect, ordered as in FillBuffers transforms.
+// Any pointer may be left null, in which case it isn't computed.
+struct TilingBatch {
+	TilingBatch();
+
+	double			*vertices;
+	double			*translations;
+	double			*aspects;
+};
+
+// One batch of tiles from a FillStream, laid out as in FillBuffers: tile
+// first + i of the fill has t1[i], t2[i], and so on.
+struct FillChunk {
+	FillChunk();
+
+	size_t size() const;
+
+	size_t					first;
+	std::vector<I64>		t1;
+	std::vector<I64>		t2;
+	std::vector<U8>			aspect;
+	std::vector<U8>			colour;
+	std::vector<U8>			flags;
+	std::vector<double>		xform;
+};
+
+// A position in a fill, for resuming a FillStream: the index of the next
+// tile, along with its true lattice indices and aspect so that a cursor
+// can be checked against the fill it's applied to.  Past the end of the
+// fill, only the index is meaningful.  toString() gives a line of text
+// that fromString() reads back.
+struct FillCursor {
+	FillCursor();
+
+	std::string toString() const;
+	bool fromString( const std::string& str );
+
+	size_t			index;
+	I64				t1;
+	I64				t2;
+	U8				aspect;
+};
+
+// How a tile from a mask fill sits relative to the mask: its bounding box
+// covers only covered pixels, or touches at least one covered pixel and
+// at least one uncovered one (or the outside of the mask).
+enum FillFlags
+{
+	INSIDE_MASK = 1, ON_MASK_BOUNDARY = 2
+};
+
+// What to do when a fill would produce more than FillOptions::max_tiles
+// tiles: fill as much of the region as fits, or give up and produce none.
+// A truncated fill of any kind is the first max_tiles (or slightly 
+// fewer) tiles of the full one, in the full one's order.
+enum FillBudget
+{
+	TRUNCATE_FILL, REJECT_FILL
+};
+
+// Options controlling how a region is filled (the region must be 
+// convex).  By default, the fill is fast but approximate: it takes every
+// lattice cell with a tile whose bounding box might meet the region, so
+// it covers the region but may produce tiles that lie entirely outside
+// it.  In exact mode, the fill visits precisely the tiles whose bounding
+// boxes meet the region.  Bounds are computed from the tiling polygon;
+// if your edge shapes wander outside of it, use margin to grow every box
+// by that distance.
+//
+// Far from the tiling's origin, doubles run out of precision.  Set
+// origin_t1 and origin_t2 to a nearby lattice cell, and give the region
+// relative to the position of that cell.  The fill still reports the
+// tiles' true lattice indices, but their transforms come out relative
+// to the origin cell, so they stay accurate at any distance.
+//
+// A nearly degenerate tiling can turn a modest region into millions of
+// tiles.  Set max_tiles to bound the size of the fill (zero means no
+// bound); over_budget says what happens if it's exceeded.  Rejection is
+// decided up front from FillAlgorithm::estimateSize() where possible, so
+// it costs next to nothing.  Either way, FillAlgorithm::isTruncated()
+// reports that the budget was hit.
+struct FillOptions {
+	FillOptions();
+
+	bool			exact;
+	double			margin;
+	I64				origin_t1;
+	I64				origin_t2;
+	size_t			max_tiles;
+	FillBudget		over_budget;
+};
+
+// Orders in which FillAlgorithm::fillIntoOrdered() can visit a fill.
+enum FillOrder
+{
+	ROW_ORDER, MORTON_ORDER, HILBERT_ORDER
+};
+
+// Ways in which FillAlgorithm::fillIntoGroups() can group a fill.
+enum FillGrouping
+{
+	GROUP_BY_COLOUR, GROUP_BY_ASPECT
+};
+
+// One row of a region fill: the lattice cells (x, row) for x in
+// [begin, end), in the fill's own lattice basis (see 
+// FillAlgorithm::getBasis()).  When that basis is the tiling's, x and row
+// are just t1 and t2.
+struct FillSpan {
+	I64				row;
+	I64				begin;
+	I64				end;
+};
+
 class TileShapeIterator
 {
 public:
 	TileShapeIterator( const IsohedralTiling& t, size_t num );
 
-	const glm::dmat3& getTransform() const;
+	glm::dmat3 getTransform() const;
+	const AffineXform& getAffine() const;
 	U8 getId() const;
 	EdgeShape getShape() const;
 	bool isReversed() const;
@@ -70,7 +258,8 @@ class TileShapePartIterator
 public:
 	TileShapePartIterator( const IsohedralTiling& t, size_t num );
 
-	const glm::dmat3& getTransform() const;
+	glm::dmat3 getTransform() const;
+	const AffineXform& getAffine() const;
 	U8 getId() const;
 	EdgeShape getShape() const;
 	bool isReversed() const;
@@ -90,7 +279,7 @@ private:
 	U8 edge_num;
 	U8 part;
 
-	glm::dmat3 xform;
+	AffineXform xform;
 	U8 edge_shape_id;
 	bool rev;
 	EdgeShape shape;
@@ -134,12 +323,21 @@ class FillRegionIterator
 	friend class FillAlgorithm;
 
 public:
+	// Relative to the fill's origin cell (see FillOptions).
 	glm::dmat3 getTransform() const;
-	int getT1() const;
-	int getT2() const;
+	AffineXform getAffine() const;
+	I64 getT1() const;
+	I64 getT2() const;
 	size_t getAspect() const;
+	// FillFlags for a tile of a mask fill; zero for any other fill.
+	U8 getFlags() const;
+	// Position of this tile in the fill, counting from zero.
+	size_t getIndex() const;
 	void dbg() const;
 
+	// Skip ahead n tiles, in O(log rows) time.
+	FillRegionIterator& advance( size_t n );
+
 	bool operator ==( const FillRegionIterator& other ) const;
 	bool operator !=( const FillRegionIterator& other ) const;
 	const FillRegionIterator& operator *();
@@ -149,53 +347,363 @@ public:
 
 private:
 	FillRegionIterator( const FillAlgorithm& algo );
-	FillRegionIterator( const FillAlgorithm& algo, 
-		double x, double y, double xlo, double xhi );
 
 	void inc();
 
 	const FillAlgorithm&	algo;
 	bool					done;
-	size_t 					call_idx;
-	double					x;
-	double 					y;
-	double 					xlo;
-	double 					xhi;
+	size_t					index;
+	size_t 					span_idx;
+	I64						x;
 	size_t					asp;
 };
 
 class FillAlgorithm
 {
 	friend class FillRegionIterator;
+	friend class FillViewport;
 
 public:
 	FillAlgorithm( const IsohedralTiling &t, 
 		const glm::dvec2& A, const glm::dvec2& B, 
 		const glm::dvec2& C, const glm::dvec2& D, bool dbg = false );
+	FillAlgorithm( const IsohedralTiling &t, 
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D, 
+		const FillOptions& opts, bool dbg = false );
+	// Fill a polygonal region given as one or more closed contours, under
+	// the even-odd rule (so a contour inside another one cuts a hole).
+	// The region needn't be convex.  Like an exact fill, this visits the
+	// tiles whose bounding boxes (grown by opts.margin) meet the region,
+	// plus the odd one lying in a gap between two runs of cells with the
+	// same aspect.  Rows may hold more than one span.
+	FillAlgorithm( const IsohedralTiling &t, 
+		const std::vector<std::vector<glm::dvec2>>& contours,
+		const FillOptions& opts, bool dbg = false );
+	// Fill the covered pixels of a raster mask: the fill visits the tiles
+	// whose bounding boxes (grown by opts.margin) touch a covered pixel,
+	// and flags each one as inside the mask or on its boundary.
+	FillAlgorithm( const IsohedralTiling &t, const FillMask& mask,
+		const FillOptions& opts, bool dbg = false );
+
+	// A rough count of the tiles in a fill of the given region, in
+	// constant time: the number of lattice cells covered by the region
+	// grown by one cell, times the number of aspects.  Infinite for a
+	// degenerate tiling.
+	static double estimateSize( const IsohedralTiling &t, 
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D );
+
+	// Did this fill run into FillOptions::max_tiles?
+	bool isTruncated() const;
+
+	// Keep geom, the snapshot this fill was made from, alive as long as 
+	// the fill or any copy of it, so the fill can outlive the code that
+	// took the snapshot (on another thread, say).
+	void retain( std::shared_ptr<const TilingGeometry> geom );
 
 	FillRegionIterator begin() const;
 	FillRegionIterator end() const;
 
+	// The number of tiles in the fill, known without visiting them, and
+	// an iterator positioned at the kth one (or end(), if k >= size()).
+	// Use these to size buffers, paginate, or split up a big fill.
+	size_t size() const;
+	FillRegionIterator operator[]( size_t k ) const;
+
+	// The fill as rows of lattice cells, leaving it to you to expand each
+	// row into tiles.  A cell (x, row) sits at x*getBasisVector(0) + 
+	// row*getBasisVector(1), and has tiling coordinates (t1, t2) = 
+	// x*getBasis(0) + row*getBasis(1).  Every cell of a span carries all
+	// of the tiling's aspects, except in exact, polygon and mask fills, 
+	// which cull per tile and give each aspect its own subrange.  
+	// getSpanOffset() gives the index of a span's first tile in iteration
+	// order.
+	size_t numSpans() const;
+	const FillSpan& getSpan( size_t idx ) const;
+	void getAspectRange( size_t idx, U8 asp, I64& begin, I64& end ) const;
+	size_t getSpanOffset( size_t idx ) const;
+	const glm::ivec2& getBasis( size_t idx ) const;
+	const glm::dvec2& getBasisVector( size_t idx ) const;
+
+	// Write the tiles of this fill, in iteration order, into the caller's
+	// buffers, composing each tile transform with view on the way out.
+	// Stops when out.capacity is reached; returns the number written.
+	// This and the other fillInto functions are instantiated for 
+	// FillBuffers and FloatFillBuffers.
+	template<typename T>
+	size_t fillInto( const glm::dmat3& view, 
+		const BasicFillBuffers<T>& out ) const;
+	// As above, but starting from the tile at index first, which is
+	// found in O(log rows) time.
+	template<typename T>
+	size_t fillInto( const glm::dmat3& view, 
+		const BasicFillBuffers<T>& out, size_t first ) const;
+	// As above, but split across num_threads threads (or one per core if
+	// num_threads is zero).  Rows are dealt out in units of roughly equal
+	// size, and each unit writes only to its own slice of the buffers, so
+	// the output is identical to fillInto()'s.
+	template<typename T>
+	size_t fillIntoParallel( const glm::dmat3& view, 
+		const BasicFillBuffers<T>& out, size_t num_threads = 0 ) const;
+	// As above, but visiting the fill in square blocks of lattice cells,
+	// block_size on a side, ordered along a Morton (Z) or Hilbert curve.
+	// Tiles that are near each other in the plane end up near each other
+	// in the buffers.  Cells within a block are visited row by row.
+	template<typename T>
+	size_t fillIntoOrdered( const glm::dmat3& view, 
+		const BasicFillBuffers<T>& out, FillOrder order, 
+		int block_size = 8 ) const;
+	// As above, but with the tiles grouped by colour or by aspect, so that
+	// each group can be drawn in one batch.  Group g ends up in positions
+	// [group_offsets[g], group_offsets[g+1]) of the buffers, holding its
+	// tiles span by span.  Only the groups whose bits are set in keep are
+	// written (the rest are left empty), and the tiles of the others are
+	// never visited.  Groups that don't fit within out.capacity are cut
+	// short.  Returns the total number of tiles written.
+	template<typename T>
+	size_t fillIntoGroups( const glm::dmat3& view, 
+		const BasicFillBuffers<T>& out, FillGrouping grouping, 
+		std::vector<size_t>& group_offsets, unsigned keep = ~0u ) const;
+
 private:
-	void doFill( const glm::dvec2& A, const glm::dvec2& B,
-		const glm::dvec2& C, const glm::dvec2& D, bool do_top );
-	void fillFixX( const glm::dvec2& A, const glm::dvec2& B,
-		const glm::dvec2& C, const glm::dvec2& D, bool do_top );
-	void fillFixY( const glm::dvec2& A, const glm::dvec2& B,
-		const glm::dvec2& C, const glm::dvec2& D, bool do_top );
+	// A fill of a region in a given lattice basis, and a fill made of
+	// given spans in a given basis.  Used by FillViewport.
+	FillAlgorithm( const IsohedralTiling &t, 
+		const glm::ivec2& u, const glm::ivec2& v,
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D );
+	FillAlgorithm( const IsohedralTiling &t, 
+		const glm::ivec2& u, const glm::ivec2& v,
+		const std::vector<FillSpan>& sp );
+
+	static void reduceBasis( const IsohedralTiling& t, glm::ivec2 red[2] );
+	static double estimateTiles( const IsohedralTiling& t, 
+		const std::vector<std::vector<glm::dvec2>>& contours );
+	bool rejectEarly( const FillOptions& opts, 
+		const std::vector<std::vector<glm::dvec2>>& contours );
+	void finish( const FillOptions& opts );
+	void setBasis( const glm::ivec2& u, const glm::ivec2& v );
+
+	void computeQuadSpans( const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D, double margin, bool exact );
+	void computePolygonSpans( 
+		const std::vector<std::vector<glm::dvec2>>& contours, double margin );
+	void computeMaskSpans( const FillMask& mask, double margin );
+	void addSpan( I64 row, I64 begin, I64 end );
+	void setOrigin( I64 o1, I64 o2 );
+	size_t spanTiles( size_t sidx ) const;
+	bool overBudget();
+	void trim( size_t k );
+	void computeOffsets();
+	void seek( FillRegionIterator& it, size_t k ) const;
+	size_t tilesBefore( size_t span, I64 x ) const;
+	bool inRange( size_t span, I64 t1, size_t asp ) const;
+
+	// Per-fill state for writing tiles into FillBuffers.
+	struct Emitter {
+		AffineXform VA[12];
+		glm::dvec2 vt1;
+		glm::dvec2 vt2;
+		int nc;
+		U8 cols[12][3][3];
+	};
+
+	void prepareEmit( const glm::dmat3& view, Emitter& em ) const;
+	template<typename T>
+	size_t emitCells( const Emitter& em, size_t sidx, I64 xbegin, I64 xend,
+		const BasicFillBuffers<T>& out, size_t count, 
+		size_t first_asp = 0 ) const;
+	template<typename T>
+	size_t emitSpans( const Emitter& em, size_t first, size_t last, 
+		const BasicFillBuffers<T>& out, size_t count ) const;
+	template<typename T>
+	void writeTile( const Emitter& em, size_t sidx, size_t asp, 
+		I64 tx, I64 ty, int m1, int m2, double dx, double dy, 
+		const BasicFillBuffers<T>& out, size_t pos ) const;
 
 	const IsohedralTiling&	tiling;
-	size_t num_calls;
+	std::shared_ptr<const TilingGeometry> retained;
 	bool debug;
 
-	struct {
-		double ymin;
-		double ymax;
-		double xlo;
-		double xhi;
-		double dxlo;
-		double dxhi;
-	} data[3];
+	// The basis of the translation lattice that the fill works in, as
+	// integer combinations of the tiling's T1 and T2, and as vectors.
+	// A Lagrange-Gauss reduced basis, so that rows stay short and cells
+	// stay fat no matter how skewed the tiling's own basis is.
+	glm::ivec2 basis[2];
+	glm::dvec2 basis_vec[2];
+	// The origin cell, in the tiling's lattice coordinates and in the
+	// fill's.
+	I64 origin[2];
+	I64 origin_cell[2];
+
+	std::vector<FillSpan> spans;
+	// In exact mode, a [begin, end) range of t1 values for every aspect
+	// of every span, clipped from the span's own range.  Empty otherwise.
+	std::vector<I64> ranges;
+	// In a mask fill, the FillFlags shared by the tiles of every aspect of
+	// every span.  Empty otherwise.
+	std::vector<U8> flags;
+	// Number of tiles in all the spans before each one (plus the total).
+	std::vector<size_t> offsets;
+
+	// The most tiles the fill may hold, and the number in the spans
+	// counted so far (the first tallied of them).
+	size_t budget;
+	size_t tally;
+	size_t tallied;
+	bool truncated;
+};
+
+// A raster mask to fill with tiles, for FillAlgorithm.  The mask is
+// width x height bytes in row-major order, and a nonzero byte marks a 
+// covered pixel.  Pixel (i, j) occupies [i, i+1] x [j, j+1] in the mask's
+// own coordinates, which to_world carries into the plane of the tiling.
+// The pixels are copied into a pyramid of min/max mipmaps, so that large
+// areas can be found to be wholly covered or wholly empty at once.  
+// Build one mask and use it for as many fills as you like.
+class FillMask
+{
+	friend class FillAlgorithm;
+
+public:
+	FillMask( const U8 *pixels, int width, int height, 
+		const glm::dmat3& to_world );
+
+	int getWidth() const;
+	int getHeight() const;
+	const glm::dmat3& getTransform() const;
+
+	// The FillFlags for a box in the mask's coordinates: INSIDE_MASK if 
+	// every pixel it overlaps is covered, ON_MASK_BOUNDARY if only some
+	// are, and zero if none are.
+	U8 coverage( const glm::dvec2& lo, const glm::dvec2& hi ) const;
+
+private:
+	void visit( size_t level, int i, int j, int i0, int j0, int i1, int j1,
+		bool& any, bool& all ) const;
+
+	int width;
+	int height;
+	glm::dmat3 to_world;
+	glm::dmat3 from_world;
+
+	// Level k holds, for each block of 2^k x 2^k pixels, whether all of
+	// them are covered (lo) and whether any of them are (hi).
+	std::vector<int> level_width;
+	std::vector<int> level_height;
+	std::vector<std::vector<U8>> lo;
+	std::vector<std::vector<U8>> hi;
+};
+
+// Tracks the lattice cells covering a viewport as it pans and zooms, so
+// that a retained-mode viewer can add and remove only the tiles that
+// changed.  Every update() fills the new region in the same lattice
+// basis and diffs its spans, row by row, against the previous fill.  The
+// cells that came into view and went out of view are then available as
+// fills of their own, which can be iterated or written out with
+// fillInto() like any other.  The cells are those of the default
+// (approximate) fill.
+class FillViewport
+{
+public:
+	FillViewport( const IsohedralTiling& t );
+
+	void update( double xmin, double ymin, double xmax, double ymax );
+	void update( const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D );
+	// Forget the current cells, so that the next update() reports all of
+	// its cells as entering.  Call this after changing the tiling.
+	void reset();
+
+	FillAlgorithm getCurrent() const;
+	FillAlgorithm getEntered() const;
+	FillAlgorithm getLeft() const;
+
+private:
+	static void subtractSpans( const std::vector<FillSpan>& a, 
+		const std::vector<FillSpan>& b, std::vector<FillSpan>& out );
+
+	const IsohedralTiling& tiling;
+	glm::ivec2 basis[2];
+
+	std::vector<FillSpan> current;
+	std::vector<FillSpan> entered;
+	std::vector<FillSpan> left;
+};
+
+// Produces a fill in batches of a fixed number of tiles, for fills too
+// big to hold in memory at once.  A background thread writes batches
+// (as fillInto() would, composing transforms with view) into a ring of
+// ring_size slots, running ahead of the consumer until the ring is full.
+// The fill must outlive the stream.
+//
+// The stream can be saved and resumed at any batch boundary with 
+// getCursor() and seek().  Or let appendToFile() take care of it: it
+// writes batches to a file as a sequence of self-contained chunks, and
+// a job that crashed or stopped part way picks up after the last
+// complete chunk when it calls appendToFile() on the same file again.
+class FillStream
+{
+public:
+	FillStream( const FillAlgorithm& fill, const glm::dmat3& view,
+		size_t batch_size, size_t ring_size = 4 );
+	~FillStream();
+
+	// Wait for the next batch and swap it into chunk, whose storage is
+	// recycled.  Returns false when the fill is exhausted.
+	bool next( FillChunk& chunk );
+
+	// The position after the last batch returned by next().
+	FillCursor getCursor() const;
+	// Continue from cursor, which must have come from a stream over the
+	// same fill.  Returns false, leaving the stream where it was, if the
+	// cursor doesn't match the fill.
+	bool seek( const FillCursor& cursor );
+
+	// Write the rest of the stream to the file at path, one chunk per
+	// batch, flushing as it goes and stopping after max_batches batches
+	// if that's nonzero.  If the file already holds chunks, the stream
+	// first seeks to the end of the last complete one, cuts off anything
+	// after it, such as a chunk left incomplete, and writes from there.
+	// Returns false if the file couldn't be written or doesn't belong to
+	// this fill.
+	bool appendToFile( const std::string& path, size_t max_batches = 0 );
+
+	// Read the chunk at the current position of in, and the cursor just
+	// past it.  A chunk is a header, the batch's attributes array by 
+	// array (in native byte order), and a trailer holding the cursor, so
+	// a chunk cut short is recognized: in that case, or at the end of
+	// the file, this returns false.
+	static bool readChunk( std::istream& in, 
+		FillChunk& chunk, FillCursor& after );
+
+private:
+	static void writeChunk( std::ostream& out, 
+		const FillChunk& chunk, const FillCursor& after );
+	static bool skipChunk( std::istream& in, FillCursor& after );
+
+	FillCursor cursorAt( size_t k ) const;
+	void produce();
+	void stop();
+
+	const FillAlgorithm& fill;
+	glm::dmat3 view;
+	size_t batch_size;
+
+	// Batches head through tail-1 (mod the ring size) are ready to be
+	// consumed.  The producer is working on the batch that starts at
+	// produced, and the consumer has seen everything before position.
+	std::vector<FillChunk> ring;
+	size_t head;
+	size_t tail;
+	size_t produced;
+	size_t position;
+	bool stopping;
+
+	std::mutex lock;
+	std::condition_variable cv;
+	std::thread producer;
 };
 
 class IsohedralTiling
@@ -203,6 +711,8 @@ class IsohedralTiling
 	friend class TileShapeIterator;
 	friend class TileShapePartIterator;
 	friend class TilingVertexProxy;
+	friend class FillAlgorithm;
+	template<TilingType IH> friend class StaticIsohedralTiling;
 
 public:
 	IsohedralTiling( TilingType ihtype );
@@ -215,6 +725,59 @@ public:
 	U8 numParameters() const;
 	void setParameters( const double *params );
 	void getParameters( double *params ) const;
+	// Change one parameter.  Everything computed from the parameters is
+	// an affine function of them, so rather than starting from scratch,
+	// these nudge each vertex, aspect transform and translation vector
+	// by the change times its coefficient for this parameter, and then 
+	// rebuild only the edges whose vertices moved.
+	void setParameter( U8 idx, double value );
+	void addToParameter( U8 idx, double delta );
+
+	// Evaluate n parameter sets for this tiling's type at once, without
+	// disturbing the tiling itself.  params holds n rows of 
+	// numParameters() values each.  The results are the same, to the
+	// bit, as calling setParameters() with each row in turn, but they
+	// come from one dense matrix product over the coefficient tables, in
+	// blocks that the compiler can vectorize, spread over num_threads
+	// threads (or one per core if num_threads is zero).
+	void computeBatch( const double *params, size_t n, 
+		const TilingBatch& out, size_t num_threads = 1 ) const;
+
+	// Exact derivatives with respect to the parameters, for optimizers.
+	// Each function writes numParameters() values, the kth holding the
+	// derivative with respect to parameter k.  Vertices, translation 
+	// vectors, and aspect and edge transforms (as in getAspectAffine() and
+	// TileShapeIterator::getAffine()) are all affine in the parameters,
+	// so their derivatives depend only on the tiling type.  A derivative
+	// of a transform is given entry by entry as an AffineXform.
+	void getVertexJacobian( U8 idx, glm::dvec2 *d ) const;
+	void getTranslationJacobian( glm::dvec2 *dt1, glm::dvec2 *dt2 ) const;
+	void getAspectJacobian( U8 idx, AffineXform *d ) const;
+	void getEdgeJacobian( U8 idx, AffineXform *d ) const;
+	// The derivatives of n points on edge idx, given in the edge's own
+	// coordinates (as you'd pass them through its transform), written to
+	// d[i*numParameters() + k] for point i and parameter k.
+	void getEdgePointJacobians( U8 idx, 
+		const glm::dvec2 *pts, size_t n, glm::dvec2 *d ) const;
+
+	// The inverse problem, for dragging tiling vertices: write to params
+	// the parameters that bring the vertices closest to targets (one per
+	// vertex) in the least squares sense, changing the current parameters
+	// as little as possible.  fitVertex() moves one vertex towards target
+	// and tries to hold the rest where they are.  Either way it's one 
+	// small matrix-vector product, using a pseudo-inverse of the type's
+	// vertex coefficients that's computed once.  Pass the results to 
+	// setParameters().
+	void fitVertices( const glm::dvec2 *targets, double *params ) const;
+	void fitVertex( U8 idx, const glm::dvec2& target, double *params ) const;
+
+	// Counters that go up whenever the tile's shape (its vertices, and so
+	// its edges) or its lattice (the aspect transforms and translation
+	// vectors) changes, so that anything you compute from them can tell
+	// in constant time whether it's out of date.  Setting a parameter to
+	// the value it already has changes nothing.
+	std::uint64_t getGeometryVersion() const;
+	std::uint64_t getLatticeVersion() const;
 
 	U8 numEdgeShapes() const;
 	EdgeShape getEdgeShape( EdgeID idx ) const;
@@ -232,7 +795,9 @@ public:
 	TilingVertexProxy vertices() const;
 
 	U8 numAspects() const;
-	const glm::dmat3& getAspectTransform( U8 idx ) const;
+	glm::dmat3 getAspectTransform( U8 idx ) const;
+	const AffineXform& getAspectAffine( U8 idx ) const;
+	void getAspectBounds( U8 idx, glm::dvec2& lo, glm::dvec2& hi ) const;
 	const glm::dvec2& getT1() const;
 	const glm::dvec2& getT2() const;
 
@@ -242,16 +807,70 @@ public:
 	FillAlgorithm fillRegion( 
 		const glm::dvec2& A, const glm::dvec2& B, 
 		const glm::dvec2& C, const glm::dvec2& D, bool dbg = false ) const;
-	U8 getColour( int t1, int t2, U8 aspect ) const;
+	FillAlgorithm fillRegion( 
+		double xmin, double ymin, double xmax, double ymax, 
+		const FillOptions& opts, bool dbg = false ) const;
+	FillAlgorithm fillRegion( 
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D, 
+		const FillOptions& opts, bool dbg = false ) const;
+	FillAlgorithm fillPolygon( 
+		const std::vector<glm::dvec2>& poly, 
+		const FillOptions& opts = FillOptions() ) const;
+	FillAlgorithm fillPolygon( 
+		const std::vector<std::vector<glm::dvec2>>& contours, 
+		const FillOptions& opts = FillOptions() ) const;
+	FillAlgorithm fillDisk( const glm::dvec2& centre, double radius,
+		const FillOptions& opts = FillOptions() ) const;
+	FillAlgorithm fillMask( const FillMask& mask, 
+		const FillOptions& opts = FillOptions() ) const;
+	double estimateFillSize( 
+		double xmin, double ymin, double xmax, double ymax ) const;
+	double estimateFillSize( 
+		const glm::dvec2& A, const glm::dvec2& B, 
+		const glm::dvec2& C, const glm::dvec2& D ) const;
+	template<typename T>
+	size_t fillRegionInto(
+		double xmin, double ymin, double xmax, double ymax,
+		const glm::dmat3& view, const BasicFillBuffers<T>& out ) const;
+	template<typename T>
+	size_t fillRegionInto(
+		const glm::dvec2& A, const glm::dvec2& B,
+		const glm::dvec2& C, const glm::dvec2& D,
+		const glm::dmat3& view, const BasicFillBuffers<T>& out ) const;
+	U8 getColour( I64 t1, I64 t2, U8 aspect ) const;
 	
 	const TilingTypeData *getRawTypeData() const;
 	
 private:
+	// The computed members below that a change of parameters has left
+	// out of date, until recompute() catches them up (before returning
+	// from the change, so that const access never writes).
+	enum {
+		STALE_VERTICES = 1, STALE_EDGES = 2, STALE_ASPECTS = 4,
+		STALE_BOUNDS = 8, STALE_TRANSLATIONS = 16, STALE_ALL = 31
+	};
+
+	bool assignParameters( const double *params );
+	void invalidate( U8 changed );
 	void recompute();
+	void update( U8 idx, double delta );
+	void computeEdge( U8 idx );
+	void computeAspectBounds( U8 idx );
 
 	TilingType tiling_type;
 	U8 num_params;
 	double parameters[6];
+	// Incremental updates since the last full recompute.
+	unsigned num_updates;
+
+	// Bit k is set if parameter k moves the vertices, or the aspects and
+	// translation vectors.
+	U8 vertex_params;
+	U8 lattice_params;
+	std::uint64_t geometry_version;
+	std::uint64_t lattice_version;
+	U8 stale;
 
 	// Computed locations of tiling vertices
 	glm::dvec2 verts[6];
@@ -259,13 +878,15 @@ private:
 	// Computed transforms to carry edge shapes to edge positions, between
 	// consecutive tiling vertices.  It's your responsibility to deal with
 	// S and U edges.
-	glm::dmat3 edges[6];
+	AffineXform edges[6];
 	// For each tiling edge, must we reverse the parameterization of the
 	// path along that edge?
 	bool reversals[6];
 
 	// Transforms to carry tiles to aspects within one translational unit.
-	glm::dmat3 aspects[12];
+	AffineXform aspects[12];
+	// Bounding box of the tiling polygon carried by each aspect transform.
+	glm::dvec2 aspect_bounds[12][2];
 	glm::dvec2 t1;
 	glm::dvec2 t2;
 
@@ -279,15 +900,196 @@ private:
 	const double *aspect_xform_coefficients;
 	const double *translation_vector_coefficients;
 	const U8 *colouring;
+	// Pseudo-inverse of the vertex coefficients, numParameters() rows by
+	// 2*numVertices() columns.
+	const double *vertex_pinv;
 };
 
+// An immutable, fully computed tiling: a type and parameters that never
+// change, with the vertices, edges, aspects and translation vectors all
+// worked out up front, so any number of threads can read it, and fill 
+// with it, at once.
+//
+// intern() hands out shared references to a single copy per distinct
+// type and parameters, so a collection of many identical designs pays
+// for one, and anything derived from a geometry can be cached against 
+// its address.  The table holds geometries weakly, so one is freed with
+// its last reference, and its dead entry is swept out later.
+class TilingGeometry
+{
+public:
+	TilingGeometry( TilingType type, const double *params );
+	// A frozen copy of tiling as it stands.
+	explicit TilingGeometry( const IsohedralTiling& tiling );
+
+	// Parameters are rounded to multiples of quantum to form the key, and
+	// an interned geometry is computed from the rounded values, so the
+	// result doesn't depend on which design happened to ask first.  
+	// Parameters that aren't finite, or too large to round, have no key,
+	// and intern() returns a null pointer for them.
+	static const double quantum;
+	static std::shared_ptr<const TilingGeometry> intern( 
+		TilingType type, const double *params );
+
+	const IsohedralTiling& getTiling() const;
+
+private:
+	IsohedralTiling tiling;
+};
+
+// A tiling that some threads edit while others read it.  Readers call
+// snapshot() for the current geometry, which stays valid and unchanged
+// for as long as they hold on to it, whatever edits come after; a fill
+// made from a snapshot can keep it alive with FillAlgorithm::retain().
+// Writers never touch a published geometry: each edit builds a new one
+// and swaps it in, to be seen by every later snapshot().  Both sides 
+// take the object's own lock, but only to copy or swap the pointer, 
+// never while a tiling is computed.  A reader pays for one reference
+// count per snapshot, a writer for one copy of the tiling per edit.
+class SharedTiling
+{
+public:
+	explicit SharedTiling( TilingType type );
+	explicit SharedTiling( std::shared_ptr<const TilingGeometry> geom );
+
+	std::shared_ptr<const TilingGeometry> snapshot() const;
+
+	void publish( std::shared_ptr<const TilingGeometry> geom );
+	void publish( const IsohedralTiling& tiling );
+	// Edit the current tiling.  When writers race, each edit applies to
+	// the geometry the previous one published, so none are lost.
+	void setParameters( const double *params );
+	void setParameter( U8 idx, double value );
+	void reset( TilingType type );
+
+private:
+	template<typename Edit>
+	void edit( Edit how );
+
+	mutable std::mutex lock;
+	std::shared_ptr<const TilingGeometry> current;
+};
+
+inline int FillMask::getWidth() const
+{
+	return width;
+}
+
+inline int FillMask::getHeight() const
+{
+	return height;
+}
+
+inline const glm::dmat3& FillMask::getTransform() const
+{
+	return to_world;
+}
+
+inline AffineXform::AffineXform()
+{
+	col[0] = glm::dvec2( 1.0, 0.0 );
+	col[1] = glm::dvec2( 0.0, 1.0 );
+	col[2] = glm::dvec2( 0.0, 0.0 );
+}
+
+inline AffineXform::AffineXform( const glm::dvec2& c0, 
+	const glm::dvec2& c1, const glm::dvec2& c2 )
+{
+	col[0] = c0;
+	col[1] = c1;
+	col[2] = c2;
+}
+
+inline AffineXform::AffineXform( const glm::dmat3& M )
+{
+	col[0] = glm::dvec2( M[0] );
+	col[1] = glm::dvec2( M[1] );
+	col[2] = glm::dvec2( M[2] );
+}
+
+inline glm::dmat3 AffineXform::toMat3() const
+{
+	return glm::dmat3( 
+		glm::dvec3( col[0], 0.0 ), 
+		glm::dvec3( col[1], 0.0 ), 
+		glm::dvec3( col[2], 1.0 ) );
+}
+
+inline glm::dvec2 AffineXform::operator *( const glm::dvec2& p ) const
+{
+	return glm::dvec2( 
+		col[0].x*p.x + col[1].x*p.y + col[2].x,
+		col[0].y*p.x + col[1].y*p.y + col[2].y );
+}
+
+inline AffineXform AffineXform::operator *( const AffineXform& other ) const
+{
+	// The same sums as glm::dmat3's product, less the terms that multiply
+	// the bottom row.  Dropping those zeros can leave a -0.0 where glm
+	// would give 0.0, but the results otherwise compare equal.
+	const glm::dvec2 *B = other.col;
+	return AffineXform( 
+		glm::dvec2( col[0].x*B[0].x + col[1].x*B[0].y,
+			col[0].y*B[0].x + col[1].y*B[0].y ),
+		glm::dvec2( col[0].x*B[1].x + col[1].x*B[1].y,
+			col[0].y*B[1].x + col[1].y*B[1].y ),
+		(*this) * B[2] );
+}
+
+inline TilingBatch::TilingBatch()
+	: vertices( nullptr )
+	, translations( nullptr )
+	, aspects( nullptr )
+{}
+
+inline FillOptions::FillOptions()
+	: exact( false )
+	, margin( 0.0 )
+	, origin_t1( 0 )
+	, origin_t2( 0 )
+	, max_tiles( 0 )
+	, over_budget( TRUNCATE_FILL )
+{}
+
+inline FillChunk::FillChunk()
+	: first( 0 )
+{}
+
+inline size_t FillChunk::size() const
+{
+	return aspect.size();
+}
+
+inline FillCursor::FillCursor()
+	: index( 0 )
+	, t1( 0 )
+	, t2( 0 )
+	, aspect( 0 )
+{}
+
+template<typename T>
+inline BasicFillBuffers<T>::BasicFillBuffers()
+	: t1( nullptr )
+	, t2( nullptr )
+	, aspect( nullptr )
+	, colour( nullptr )
+	, flags( nullptr )
+	, xform( nullptr )
+	, capacity( 0 )
+{}
+
 inline TileShapeIterator::TileShapeIterator( 
 		const IsohedralTiling& t, size_t num )
 	: tiling( t )
 	, edge_num( num )
 {}
 
-inline const glm::dmat3& TileShapeIterator::getTransform() const
+inline glm::dmat3 TileShapeIterator::getTransform() const
+{
+	return getAffine().toMat3();
+}
+
+inline const AffineXform& TileShapeIterator::getAffine() const
 {
 	return tiling.edges[edge_num];
 }
@@ -389,7 +1191,12 @@ inline TilingVertexProxy::TilingVertexProxy( const IsohedralTiling& t )
 	: tiling( t )
 {}
 
-inline const glm::dmat3& TileShapePartIterator::getTransform() const
+inline glm::dmat3 TileShapePartIterator::getTransform() const
+{
+	return xform.toMat3();
+}
+
+inline const AffineXform& TileShapePartIterator::getAffine() const
 {
 	return xform;
 }
@@ -452,24 +1259,32 @@ inline const glm::dvec2 *TilingVertexProxy::end() const
 
 inline glm::dmat3 FillRegionIterator::getTransform() const
 {
-	glm::dmat3 M( algo.tiling.getAspectTransform( asp ) );
+	return getAffine().toMat3();
+}
+
+inline AffineXform FillRegionIterator::getAffine() const
+{
+	AffineXform M( algo.tiling.getAspectAffine( U8( asp ) ) );
 	const glm::dvec2& t1 = algo.tiling.getT1();
 	const glm::dvec2& t2 = algo.tiling.getT2();
 
-	M[2][0] += int(x)*t1.x + int(y)*t2.x;
-	M[2][1] += int(x)*t1.y + int(y)*t2.y;
+	double tx = double( getT1() - algo.origin[0] );
+	double ty = double( getT2() - algo.origin[1] );
+
+	M.col[2].x += tx*t1.x + ty*t2.x;
+	M.col[2].y += tx*t1.y + ty*t2.y;
 
 	return M;
 }
 
-inline int FillRegionIterator::getT1() const
+inline I64 FillRegionIterator::getT1() const
 {
-	return int(x);
+	return x*algo.basis[0].x + algo.spans[span_idx].row*algo.basis[1].x;
 }
 
-inline int FillRegionIterator::getT2() const
+inline I64 FillRegionIterator::getT2() const
 {
-	return int(y);
+	return x*algo.basis[0].y + algo.spans[span_idx].row*algo.basis[1].y;
 }
 
 inline size_t FillRegionIterator::getAspect() const
@@ -477,6 +1292,19 @@ inline size_t FillRegionIterator::getAspect() const
 	return asp;
 }
 
+inline U8 FillRegionIterator::getFlags() const
+{
+	if( algo.flags.empty() ) {
+		return 0;
+	}
+	return algo.flags[ span_idx*algo.tiling.numAspects() + asp ];
+}
+
+inline size_t FillRegionIterator::getIndex() const
+{
+	return index;
+}
+
 inline bool FillRegionIterator::operator !=( 
 	const FillRegionIterator& other ) const
 {
@@ -515,12 +1343,28 @@ inline const glm::dvec2& IsohedralTiling::getT2() const
 {
 	return t2;
 }
+
+inline std::uint64_t IsohedralTiling::getGeometryVersion() const
+{
+	return geometry_version;
+}
+
+inline std::uint64_t IsohedralTiling::getLatticeVersion() const
+{
+	return lattice_version;
+}
+
 	
 inline const TilingTypeData *IsohedralTiling::getRawTypeData() const
 {
     return ttd;
 }
 
+inline const IsohedralTiling& TilingGeometry::getTiling() const
+{
+	return tiling;
+}
+
 inline TileShapeIterator IsohedralTiling::beginShape() const
 {
 	return TileShapeIterator( *this, 0 );
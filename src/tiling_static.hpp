@@ -0,0 +1,248 @@
+#ifndef __TILING_STATIC_HPP__
+#define __TILING_STATIC_HPP__
+
+#include <algorithm>
+#include <type_traits>
+
+#include "tiling.hpp"
+
+namespace csk {
+
+// The tables describing every tiling type, as constant expressions.
+#include "tiling_arraydecl.inc"
+
+// An IsohedralTiling whose type is fixed at compile time.  The numbers
+// of parameters, vertices and aspects, and the coefficients that turn
+// parameters into vertices, transforms and translation vectors, are all
+// constants, so setParameters() and getColour() compile down to 
+// unrolled code that reads coefficients from fixed addresses.
+// In every other respect this is an IsohedralTiling, and it can be used
+// anywhere one is expected, fills included.  (Called through an
+// IsohedralTiling, setParameters() takes the general route, with the
+// same results.)
+template<TilingType IH>
+class StaticIsohedralTiling : public IsohedralTiling
+{
+	static_assert( tiling_type_data[IH].num_vertices > 0,
+		"IH must be one of the values in tiling_types" );
+
+public:
+	StaticIsohedralTiling();
+	explicit StaticIsohedralTiling( const double *params );
+
+	void setParameters( const double *params );
+	U8 getColour( I64 t1, I64 t2, U8 aspect ) const;
+
+private:
+	// Changing the type would defeat the purpose.
+	using IsohedralTiling::reset;
+
+	template<int N> using Count = std::integral_constant<int, N>;
+
+	static constexpr int np = tiling_type_data[IH].num_params;
+	static constexpr int nv = tiling_type_data[IH].num_vertices;
+	static constexpr int na = tiling_type_data[IH].num_aspects;
+	static constexpr int nc = tiling_type_data[IH].colouring[18];
+
+	static constexpr const TilingTypeData& data();
+
+	// The same sums as IsohedralTiling::recompute(), in the same order,
+	// each loop unrolled by recursion on a Count.  The results compare 
+	// equal (==) to the dynamic ones, though a zero may differ in sign.
+	double eval( const double *coeffs ) const;
+	template<int N> double dot( const double *coeffs, Count<N> ) const;
+	double dot( const double *coeffs, Count<0> ) const;
+
+	template<int N> void computeVertices( Count<N> );
+	void computeVertices( Count<0> );
+	template<int N> void computeEdges( Count<N> );
+	void computeEdges( Count<0> );
+	template<int N> void computeAspects( Count<N> );
+	void computeAspects( Count<0> );
+	template<int N> void computeBounds( 
+		const AffineXform& M, glm::dvec2& lo, glm::dvec2& hi, Count<N> );
+	void computeBounds( 
+		const AffineXform& M, glm::dvec2& lo, glm::dvec2& hi, Count<1> );
+	void recomputeStatic();
+
+	template<int N> static U8 permute( U8 col, int m, int off, Count<N> );
+	static U8 permute( U8 col, int m, int off, Count<0> );
+};
+
+template<TilingType IH>
+inline StaticIsohedralTiling<IH>::StaticIsohedralTiling()
+	: IsohedralTiling( IH )
+{}
+
+template<TilingType IH>
+inline StaticIsohedralTiling<IH>::StaticIsohedralTiling( 
+		const double *params )
+	: IsohedralTiling( IH )
+{
+	setParameters( params );
+}
+
+template<TilingType IH>
+inline void StaticIsohedralTiling<IH>::setParameters( const double *params )
+{
+	if( assignParameters( params ) ) {
+		recomputeStatic();
+	}
+}
+
+template<TilingType IH>
+inline U8 StaticIsohedralTiling<IH>::getColour( 
+	I64 t1, I64 t2, U8 aspect ) const
+{
+	int mt1 = int( (t1 % nc + nc) % nc );
+	int mt2 = int( (t2 % nc + nc) % nc );
+	U8 col = data().colouring[aspect];
+
+	// Each permutation is applied mt < nc times.
+	col = permute( col, mt1, 12, Count<nc-1>() );
+	return permute( col, mt2, 15, Count<nc-1>() );
+}
+
+template<TilingType IH>
+constexpr const TilingTypeData& StaticIsohedralTiling<IH>::data()
+{
+	return tiling_type_data[IH];
+}
+
+template<TilingType IH>
+inline double StaticIsohedralTiling<IH>::eval( const double *coeffs ) const
+{
+	// Affine term last, as in ddot().
+	return dot( coeffs, Count<np>() ) + coeffs[np];
+}
+
+template<TilingType IH>
+template<int N>
+inline double StaticIsohedralTiling<IH>::dot( 
+	const double *coeffs, Count<N> ) const
+{
+	return dot( coeffs, Count<N-1>() ) + coeffs[N-1] * parameters[N-1];
+}
+
+template<TilingType IH>
+inline double StaticIsohedralTiling<IH>::dot( 
+	const double *, Count<0> ) const
+{
+	return 0.0;
+}
+
+template<TilingType IH>
+template<int N>
+inline void StaticIsohedralTiling<IH>::computeVertices( Count<N> )
+{
+	computeVertices( Count<N-1>() );
+	const double *c = data().tiling_vertex_coeffs + 2*(np+1)*(N-1);
+	verts[N-1].x = eval( c );
+	verts[N-1].y = eval( c + (np+1) );
+}
+
+template<TilingType IH>
+inline void StaticIsohedralTiling<IH>::computeVertices( Count<0> )
+{}
+
+template<TilingType IH>
+template<int N>
+inline void StaticIsohedralTiling<IH>::computeEdges( Count<N> )
+{
+	computeEdges( Count<N-1>() );
+
+	// match( p, q ) * M_orients[2*fl+ro], multiplied out: a flip or a
+	// rotation (but not both) reverses the edge, and a rotation also
+	// mirrors it across its own line.
+	const bool fl = data().edge_orientations[2*(N-1)];
+	const bool ro = data().edge_orientations[2*(N-1)+1];
+	const glm::dvec2& p = verts[N-1];
+	const glm::dvec2& q = verts[N % nv];
+	glm::dvec2 a( q.x - p.x, q.y - p.y );
+	glm::dvec2 b( p.y - q.y, q.x - p.x );
+
+	edges[N-1] = AffineXform( 
+		(fl != ro) ? -a : a, ro ? -b : b, (fl != ro) ? (a + p) : p );
+}
+
+template<TilingType IH>
+inline void StaticIsohedralTiling<IH>::computeEdges( Count<0> )
+{}
+
+template<TilingType IH>
+template<int N>
+inline void StaticIsohedralTiling<IH>::computeAspects( Count<N> )
+{
+	computeAspects( Count<N-1>() );
+
+	const double *c = data().aspect_xform_coeffs + 6*(np+1)*(N-1);
+	AffineXform& M = aspects[N-1];
+	M.col[0].x = eval( c );
+	M.col[1].x = eval( c + (np+1) );
+	M.col[2].x = eval( c + 2*(np+1) );
+	M.col[0].y = eval( c + 3*(np+1) );
+	M.col[1].y = eval( c + 4*(np+1) );
+	M.col[2].y = eval( c + 5*(np+1) );
+
+	computeBounds( M, aspect_bounds[N-1][0], aspect_bounds[N-1][1], 
+		Count<nv>() );
+}
+
+template<TilingType IH>
+inline void StaticIsohedralTiling<IH>::computeAspects( Count<0> )
+{}
+
+template<TilingType IH>
+template<int N>
+inline void StaticIsohedralTiling<IH>::computeBounds( 
+	const AffineXform& M, glm::dvec2& lo, glm::dvec2& hi, Count<N> )
+{
+	computeBounds( M, lo, hi, Count<N-1>() );
+	glm::dvec2 P( M * verts[N-1] );
+	lo = glm::min( lo, P );
+	hi = glm::max( hi, P );
+}
+
+template<TilingType IH>
+inline void StaticIsohedralTiling<IH>::computeBounds( 
+	const AffineXform& M, glm::dvec2& lo, glm::dvec2& hi, Count<1> )
+{
+	lo = M * verts[0];
+	hi = lo;
+}
+
+template<TilingType IH>
+inline void StaticIsohedralTiling<IH>::recomputeStatic()
+{
+	num_updates = 0;
+	stale = 0;
+	computeVertices( Count<nv>() );
+	computeEdges( Count<nv>() );
+	computeAspects( Count<na>() );
+
+	const double *c = data().translation_vector_coeffs;
+	t1.x = eval( c );
+	t1.y = eval( c + (np+1) );
+	t2.x = eval( c + 2*(np+1) );
+	t2.y = eval( c + 3*(np+1) );
+}
+
+template<TilingType IH>
+template<int N>
+inline U8 StaticIsohedralTiling<IH>::permute( 
+	U8 col, int m, int off, Count<N> )
+{
+	col = permute( col, m, off, Count<N-1>() );
+	return (m >= N) ? data().colouring[off+col] : col;
+}
+
+template<TilingType IH>
+inline U8 StaticIsohedralTiling<IH>::permute( 
+	U8 col, int, int, Count<0> )
+{
+	return col;
+}
+
+};
+
+#endif // __TILING_STATIC_HPP__
@@ -0,0 +1,603 @@
+// Regression tests for region fills.  Prints each failure and exits 
+// with a nonzero status if there were any.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "tiling.hpp"
+
+using namespace std;
+using namespace glm;
+using namespace csk;
+
+static int failures = 0;
+
+static void check( bool ok, const char *what, int ihtype )
+{
+	if( !ok ) {
+		cerr << "FAILED: " << what << " (IH" << ihtype << ")" << endl;
+		++failures;
+	}
+}
+
+static bool insidePolygon( const vector<dvec2>& poly, const dvec2& P )
+{
+	bool inside = false;
+	for( size_t idx = 0, prev = poly.size() - 1; 
+			idx < poly.size(); prev = idx++ ) {
+		const dvec2& A = poly[idx];
+		const dvec2& B = poly[prev];
+		if( ((A.y > P.y) != (B.y > P.y)) 
+				&& (P.x < (B.x - A.x) * (P.y - A.y) / (B.y - A.y) + A.x) ) {
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+// Does every point of a grid of samples over the region lie in one of
+// the fill's tiles?
+static bool covers( const IsohedralTiling& tiling, const FillAlgorithm& fill,
+	const vector<dvec2>& region )
+{
+	dvec2 lo( HUGE_VAL );
+	dvec2 hi( -HUGE_VAL );
+	for( const dvec2& P : region ) {
+		lo = min( lo, P );
+		hi = max( hi, P );
+	}
+
+	vector<vector<dvec2>> tiles;
+	for( auto i : fill ) {
+		dmat3 T = i->getTransform();
+		vector<dvec2> poly;
+		for( auto v : tiling.vertices() ) {
+			poly.push_back( dvec2( T * dvec3( v, 1.0 ) ) );
+		}
+		tiles.push_back( poly );
+	}
+
+	const int N = 40;
+	for( int i = 0; i < N; ++i ) {
+		for( int j = 0; j < N; ++j ) {
+			dvec2 P( lo.x + (i + 0.5) * (hi.x - lo.x) / N, 
+				lo.y + (j + 0.5) * (hi.y - lo.y) / N );
+			if( !insidePolygon( region, P ) ) {
+				continue;
+			}
+			bool found = false;
+			for( const vector<dvec2>& poly : tiles ) {
+				if( insidePolygon( poly, P ) ) {
+					found = true;
+					break;
+				}
+			}
+			if( !found ) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool covers( const IsohedralTiling& tiling, const FillAlgorithm& fill,
+	double xmin, double ymin, double xmax, double ymax )
+{
+	const dvec2 rect[4] = { dvec2( xmin, ymin ), dvec2( xmax, ymin ), 
+		dvec2( xmax, ymax ), dvec2( xmin, ymax ) };
+	return covers( tiling, fill, vector<dvec2>( rect, rect + 4 ) );
+}
+
+// The default fill may produce extra tiles, but it covers its region,
+// whether that's a rectangle or a rotated quad.  Like an exact fill, it
+// works in the reduced basis.
+static void testDefaultFillCoverage()
+{
+	const dvec2 quad[4] = { 
+		dvec2( -5.0, -3.0 ), dvec2( 4.0, -6.0 ), 
+		dvec2( 7.0, 3.0 ), dvec2( -2.0, 6.0 ) };
+
+	for( size_t idx = 0; idx < num_types; ++idx ) {
+		int ihtype = tiling_types[idx];
+		IsohedralTiling tiling( ihtype );
+		FillAlgorithm fill = tiling.fillRegion( -6, -5, 7, 4 );
+		check( covers( tiling, fill, -6, -5, 7, 4 ), 
+			"default fill covers its region", ihtype );
+
+		FillAlgorithm rotated = tiling.fillRegion( 
+			quad[0], quad[1], quad[2], quad[3] );
+		vector<dvec2> poly( quad, quad + 4 );
+		check( covers( tiling, rotated, poly ), 
+			"default fill covers a rotated region", ihtype );
+
+		FillOptions opts;
+		opts.exact = true;
+		FillAlgorithm exact = tiling.fillRegion( -6, -5, 7, 4, opts );
+		check( (fill.getBasis( 0 ) == exact.getBasis( 0 )) 
+			&& (fill.getBasis( 1 ) == exact.getBasis( 1 )), 
+			"default fill uses the reduced basis", ihtype );
+	}
+}
+
+// Lattice indices written to fill buffers are 64 bits wide, so a fill 
+// more than 2^31 translations from its origin doesn't wrap.
+static void testFarIndices()
+{
+	IsohedralTiling tiling( 1 );
+	dvec2 far = 3.0e9 * tiling.getT1();
+	FillOptions opts;
+	opts.exact = true;
+	FillAlgorithm fill = tiling.fillRegion( 
+		far.x - 2.0, far.y - 2.0, far.x + 2.0, far.y + 2.0, opts );
+
+	size_t n = fill.size();
+	vector<I64> t1s( n );
+	vector<I64> t2s( n );
+	FillBuffers out;
+	out.t1 = t1s.data();
+	out.t2 = t2s.data();
+	out.capacity = n;
+	size_t count = fill.fillInto( dmat3( 1.0 ), out );
+
+	bool ok = (n > 0) && (count == n);
+	size_t idx = 0;
+	for( auto i : fill ) {
+		ok = ok && (i->getT1() > (I64( 1 ) << 31)) 
+			&& (t1s[idx] == i->getT1()) && (t2s[idx] == i->getT2());
+		++idx;
+	}
+	check( ok, "far lattice indices survive fillInto()", 1 );
+}
+
+// A mask fill over its budget is rejected outright, or cut back to the 
+// budget, just like a rectangle or polygon fill.
+static void testMaskBudget()
+{
+	IsohedralTiling tiling( 1 );
+	vector<U8> pixels( 64 * 64, 1 );
+	FillMask mask( pixels.data(), 64, 64, 
+		dmat3( 0.25, 0.0, 0.0, 0.0, 0.25, 0.0, -8.0, -8.0, 1.0 ) );
+
+	FillOptions opts;
+	opts.max_tiles = 10;
+	opts.over_budget = REJECT_FILL;
+	FillAlgorithm rejected = tiling.fillMask( mask, opts );
+
+	vector<I64> t1s( 1 );
+	FillBuffers out;
+	out.t1 = t1s.data();
+	out.capacity = 1;
+	check( (rejected.size() == 0) && rejected.isTruncated() 
+		&& (rejected.fillInto( dmat3( 1.0 ), out ) == 0), 
+		"mask fill over budget is rejected", 1 );
+
+	opts.over_budget = TRUNCATE_FILL;
+	FillAlgorithm trimmed = tiling.fillMask( mask, opts );
+	size_t n = 0;
+	for( auto i : trimmed ) {
+		(void)i;
+		++n;
+	}
+	check( (trimmed.size() > 0) && (trimmed.size() <= 10) 
+		&& (n == trimmed.size()) && trimmed.isTruncated(), 
+		"mask fill over budget is truncated", 1 );
+}
+
+// With the fill anchored to an origin cell, buffers still get the true
+// lattice indices (and the matching colours), like the iterator does.
+static void testOriginIndices()
+{
+	IsohedralTiling tiling( 4 );
+	FillOptions opts;
+	opts.origin_t1 = 1000000007;
+	opts.origin_t2 = -5;
+	FillAlgorithm fill = tiling.fillRegion( -3.0, -3.0, 3.0, 3.0, opts );
+
+	size_t n = fill.size();
+	vector<I64> t1s( n );
+	vector<I64> t2s( n );
+	vector<U8> cols( n );
+	vector<double> xforms( 6 * n );
+	FillBuffers out;
+	out.t1 = t1s.data();
+	out.t2 = t2s.data();
+	out.colour = cols.data();
+	out.xform = xforms.data();
+	out.capacity = n;
+	size_t count = fill.fillInto( dmat3( 1.0 ), out );
+
+	bool ok = (n > 0) && (count == n);
+	size_t idx = 0;
+	for( auto i : fill ) {
+		dmat3 M = i->getTransform();
+		ok = ok && (t1s[idx] == i->getT1()) && (t2s[idx] == i->getT2())
+			&& (i->getT1() > 999999990)
+			&& (cols[idx] == tiling.getColour( 
+				t1s[idx], t2s[idx], i->getAspect() ))
+			&& (fabs( xforms[6*idx + 4] - M[2][0] ) < 1e-9)
+			&& (fabs( xforms[6*idx + 5] - M[2][1] ) < 1e-9);
+		++idx;
+	}
+	check( ok, "buffer indices match the iterator away from the origin", 4 );
+}
+
+static string readFile( const char *path )
+{
+	ifstream in( path, ios::binary );
+	ostringstream ss;
+	ss << in.rdbuf();
+	return ss.str();
+}
+
+static void writeFile( const char *path, const string& data )
+{
+	ofstream out( path, ios::binary | ios::trunc );
+	out << data;
+}
+
+static void testStreamResume()
+{
+	const char *path = "filltest.chunks";
+	IsohedralTiling tiling( 1 );
+	FillAlgorithm fill = tiling.fillRegion( -6.0, -6.0, 6.0, 6.0 );
+
+	remove( path );
+	FillStream whole( fill, dmat3( 1.0 ), 10 );
+	bool ok = whole.appendToFile( path );
+	string full = readFile( path );
+
+	// Find where the second chunk ends.
+	ifstream in( path, ios::binary );
+	FillChunk chunk;
+	FillCursor after;
+	vector<streamoff> ends;
+	while( FillStream::readChunk( in, chunk, after ) ) {
+		ends.push_back( in.tellg() );
+	}
+	in.close();
+	ok = ok && (ends.size() >= 3);
+
+	// As if a job died part way through the third chunk, and left junk
+	// reaching past where the complete file would end.
+	if( ok ) {
+		size_t cut = size_t( ends[1] + ends[2] ) / 2;
+		writeFile( path, full.substr( 0, cut ) + string( full.size(), 'x' ) );
+		FillStream resumed( fill, dmat3( 1.0 ), 10 );
+		ok = resumed.appendToFile( path ) && (readFile( path ) == full);
+	}
+	remove( path );
+	check( ok, "a stream resumed from a cut-off file rewrites its tail", 1 );
+}
+
+static void testInternKeys()
+{
+	IsohedralTiling tiling( 1 );
+	double params[6];
+	tiling.getParameters( params );
+	check( TilingGeometry::intern( tiling.getTilingType(), params )
+		== TilingGeometry::intern( tiling.getTilingType(), params ), 
+		"interning the same parameters shares a geometry", 1 );
+
+	const double bad[] = { 
+		std::numeric_limits<double>::quiet_NaN(),
+		std::numeric_limits<double>::infinity(),
+		-1e300 };
+	for( double b : bad ) {
+		double p[6];
+		std::copy( params, params + 6, p );
+		p[0] = b;
+		check( !TilingGeometry::intern( tiling.getTilingType(), p ),
+			"unroundable parameters aren't interned", 1 );
+	}
+}
+
+typedef tuple<I64, I64, size_t> TileKey;
+
+static vector<TileKey> tilesOf( const FillAlgorithm& fill )
+{
+	vector<TileKey> ret;
+	for( auto i : fill ) {
+		ret.push_back( TileKey( i->getT1(), i->getT2(), i->getAspect() ) );
+	}
+	return ret;
+}
+
+static vector<TileKey> sortedTilesOf( const FillAlgorithm& fill )
+{
+	vector<TileKey> ret = tilesOf( fill );
+	sort( ret.begin(), ret.end() );
+	return ret;
+}
+
+// One fill of each kind: default, exact, polygon and mask.
+static const int num_fill_kinds = 4;
+
+static FillAlgorithm makeFill( const IsohedralTiling& tiling, int kind, 
+	const FillMask& mask, const FillOptions& opts = FillOptions() )
+{
+	const dvec2 ell[6] = { 
+		dvec2( -5.0, -4.0 ), dvec2( 5.0, -4.0 ), dvec2( 5.0, 0.0 ), 
+		dvec2( 0.0, 0.0 ), dvec2( 0.0, 4.0 ), dvec2( -5.0, 4.0 ) };
+
+	FillOptions o = opts;
+	switch( kind ) {
+	case 0:
+		return tiling.fillRegion( -5.0, -4.0, 6.0, 3.0, o );
+	case 1:
+		o.exact = true;
+		return tiling.fillRegion( -5.0, -4.0, 6.0, 3.0, o );
+	case 2:
+		return tiling.fillPolygon( vector<dvec2>( ell, ell + 6 ), o );
+	default:
+		return tiling.fillMask( mask, o );
+	}
+}
+
+// A disk of radius 4 around the origin, at eight pixels per unit.
+static FillMask makeDiskMask()
+{
+	vector<U8> pixels( 64 * 64 );
+	for( int j = 0; j < 64; ++j ) {
+		for( int i = 0; i < 64; ++i ) {
+			dvec2 P( i - 31.5, j - 31.5 );
+			pixels[j*64 + i] = (dot( P, P ) < 32.0 * 32.0) ? 1 : 0;
+		}
+	}
+	return FillMask( pixels.data(), 64, 64, 
+		dmat3( 0.125, 0.0, 0.0, 0.0, 0.125, 0.0, -4.0, -4.0, 1.0 ) );
+}
+
+// Ordered fills visit the same tiles as a plain fill, just in another 
+// order, including when the blocks don't divide the fill evenly.
+static void testOrderedPermutation()
+{
+	const FillOrder orders[2] = { MORTON_ORDER, HILBERT_ORDER };
+	const int block_sizes[2] = { 8, 3 };
+	FillMask mask = makeDiskMask();
+
+	for( int ihtype : { 1, 4, 21, 41, 84 } ) {
+		IsohedralTiling tiling( ihtype );
+		for( int kind = 0; kind < num_fill_kinds; ++kind ) {
+			FillAlgorithm fill = makeFill( tiling, kind, mask );
+			vector<TileKey> expect = sortedTilesOf( fill );
+			size_t n = fill.size();
+
+			vector<I64> t1s( n );
+			vector<I64> t2s( n );
+			vector<U8> asps( n );
+			FillBuffers out;
+			out.t1 = t1s.data();
+			out.t2 = t2s.data();
+			out.aspect = asps.data();
+			out.capacity = n;
+
+			bool ok = (n > 0);
+			for( FillOrder order : orders ) {
+				for( int bs : block_sizes ) {
+					size_t count = fill.fillIntoOrdered( 
+						dmat3( 1.0 ), out, order, bs );
+					vector<TileKey> got;
+					for( size_t k = 0; k < count; ++k ) {
+						got.push_back( TileKey( t1s[k], t2s[k], asps[k] ) );
+					}
+					sort( got.begin(), got.end() );
+					ok = ok && (count == n) && (got == expect);
+				}
+			}
+			check( ok, "ordered fills are permutations of the plain fill", 
+				ihtype );
+		}
+	}
+}
+
+// operator[], advance() and fillInto() from an index land on the same
+// tiles as stepping an iterator, and a truncated fill is a prefix of
+// the full one.
+static void testSeekAndTrim()
+{
+	FillMask mask = makeDiskMask();
+
+	for( int ihtype : { 1, 4, 21, 41, 84 } ) {
+		IsohedralTiling tiling( ihtype );
+		for( int kind = 0; kind < num_fill_kinds; ++kind ) {
+			FillAlgorithm fill = makeFill( tiling, kind, mask );
+			vector<TileKey> tiles = tilesOf( fill );
+			size_t n = fill.size();
+
+			bool ok = (n == tiles.size()) && (n > 0) 
+				&& (fill[n] == fill.end());
+			size_t step = std::max( size_t( 1 ), n / 17 );
+			for( size_t k = 0; k < n; k += step ) {
+				FillRegionIterator i = fill[k];
+				FillRegionIterator j = fill.begin();
+				j.advance( k );
+				ok = ok && (i->getIndex() == k) && (j->getIndex() == k)
+					&& (TileKey( i->getT1(), i->getT2(), i->getAspect() ) 
+						== tiles[k])
+					&& (TileKey( j->getT1(), j->getT2(), j->getAspect() ) 
+						== tiles[k]);
+
+				vector<I64> t1s( n - k );
+				vector<I64> t2s( n - k );
+				vector<U8> asps( n - k );
+				FillBuffers out;
+				out.t1 = t1s.data();
+				out.t2 = t2s.data();
+				out.aspect = asps.data();
+				out.capacity = n - k;
+				ok = ok && (fill.fillInto( dmat3( 1.0 ), out, k ) == n - k);
+				for( size_t m = k; ok && (m < n); ++m ) {
+					ok = (TileKey( t1s[m-k], t2s[m-k], asps[m-k] ) 
+						== tiles[m]);
+				}
+			}
+			check( ok, "seeking matches a stepped iterator", ihtype );
+
+			FillOptions opts;
+			opts.max_tiles = n / 3;
+			opts.over_budget = TRUNCATE_FILL;
+			FillAlgorithm trimmed = makeFill( tiling, kind, mask, opts );
+			vector<TileKey> head = tilesOf( trimmed );
+			check( trimmed.isTruncated() && (head.size() > 0) 
+				&& (head.size() <= opts.max_tiles) 
+				&& (head.size() == trimmed.size())
+				&& std::equal( head.begin(), head.end(), tiles.begin() ),
+				"a truncated fill is a prefix of the full fill", ihtype );
+		}
+	}
+}
+
+// A stream's batches add up to fillInto(), a cursor round trips through
+// text and resumes the stream where it left off, and chunks written to
+// a file read back as they went in.
+static void testStreamChunks()
+{
+	const char *path = "filltest.chunks";
+	IsohedralTiling tiling( 21 );
+	FillAlgorithm fill = tiling.fillRegion( -6.0, -6.0, 6.0, 6.0 );
+	dmat3 view( 2.0, 0.0, 0.0, 0.0, 2.0, 0.0, 10.0, -3.0, 1.0 );
+
+	size_t n = fill.size();
+	vector<I64> t1s( n );
+	vector<I64> t2s( n );
+	vector<U8> asps( n );
+	vector<double> xforms( 6 * n );
+	FillBuffers out;
+	out.t1 = t1s.data();
+	out.t2 = t2s.data();
+	out.aspect = asps.data();
+	out.xform = xforms.data();
+	out.capacity = n;
+	fill.fillInto( view, out );
+
+	// Does chunk hold tiles chunk.first onwards, as written by fillInto()?
+	auto matches = [&]( const FillChunk& chunk ) {
+		bool ok = (chunk.size() > 0) && (chunk.first + chunk.size() <= n);
+		for( size_t k = 0; ok && (k < chunk.size()); ++k ) {
+			size_t idx = chunk.first + k;
+			ok = (chunk.t1[k] == t1s[idx]) && (chunk.t2[k] == t2s[idx])
+				&& (chunk.aspect[k] == asps[idx]);
+			for( size_t c = 0; ok && (c < 6); ++c ) {
+				ok = (fabs( chunk.xform[6*k + c] - xforms[6*idx + c] ) 
+					< 1e-9);
+			}
+		}
+		return ok;
+	};
+
+	FillStream stream( fill, view, 7 );
+	FillChunk chunk;
+	FillCursor mid;
+	size_t seen = 0;
+	size_t batches = 0;
+	bool ok = (n > 30);
+	while( stream.next( chunk ) ) {
+		ok = ok && (chunk.first == seen) && matches( chunk );
+		seen += chunk.size();
+		if( ++batches == 3 ) {
+			mid = stream.getCursor();
+		}
+	}
+	check( ok && (seen == n), "stream batches match fillInto()", 21 );
+
+	FillCursor parsed;
+	ok = parsed.fromString( mid.toString() ) 
+		&& (parsed.index == mid.index) && (parsed.index == 21)
+		&& (parsed.t1 == mid.t1) && (parsed.t2 == mid.t2) 
+		&& (parsed.aspect == mid.aspect);
+	FillStream resumed( fill, view, 7 );
+	ok = ok && resumed.seek( parsed );
+	seen = parsed.index;
+	while( ok && resumed.next( chunk ) ) {
+		ok = (chunk.first == seen) && matches( chunk );
+		seen += chunk.size();
+	}
+	FillCursor wrong = parsed;
+	++wrong.t1;
+	FillStream rejected( fill, view, 7 );
+	check( ok && (seen == n) && !rejected.seek( wrong ), 
+		"a stream resumes from a cursor", 21 );
+
+	remove( path );
+	FillStream saved( fill, view, 7 );
+	ok = saved.appendToFile( path, 2 );
+	FillStream rest( fill, view, 7 );
+	ok = ok && rest.appendToFile( path );
+	ifstream in( path, ios::binary );
+	FillCursor after;
+	seen = 0;
+	while( ok && FillStream::readChunk( in, chunk, after ) ) {
+		ok = (chunk.first == seen) && matches( chunk ) 
+			&& (after.index == seen + chunk.size());
+		seen += chunk.size();
+	}
+	in.close();
+	remove( path );
+	check( ok && (seen == n), "chunks read back from a file", 21 );
+}
+
+// After a pan, a viewport holds the same cells as one that only ever saw
+// the new region, and those are the cells of the default fill.  Entered
+// and left are the differences between the old and new cells.
+static void testViewportUpdate()
+{
+	for( int ihtype : { 1, 4, 21, 41, 84 } ) {
+		IsohedralTiling tiling( ihtype );
+		FillViewport before( tiling );
+		before.update( -5.0, -4.0, 5.0, 4.0 );
+		vector<TileKey> old_tiles = sortedTilesOf( before.getCurrent() );
+
+		FillViewport moved( tiling );
+		moved.update( -5.0, -4.0, 5.0, 4.0 );
+		moved.update( -2.0, -6.0, 8.0, 2.0 );
+		FillViewport fresh( tiling );
+		fresh.update( -2.0, -6.0, 8.0, 2.0 );
+
+		vector<TileKey> new_tiles = sortedTilesOf( moved.getCurrent() );
+		vector<TileKey> entered;
+		vector<TileKey> left;
+		set_difference( new_tiles.begin(), new_tiles.end(), 
+			old_tiles.begin(), old_tiles.end(), back_inserter( entered ) );
+		set_difference( old_tiles.begin(), old_tiles.end(), 
+			new_tiles.begin(), new_tiles.end(), back_inserter( left ) );
+
+		check( (new_tiles == sortedTilesOf( fresh.getCurrent() ))
+			&& (new_tiles == sortedTilesOf( 
+				tiling.fillRegion( -2.0, -6.0, 8.0, 2.0 ) )), 
+			"an updated viewport matches a fresh fill", ihtype );
+		check( !entered.empty() && !left.empty()
+			&& (entered == sortedTilesOf( moved.getEntered() ))
+			&& (left == sortedTilesOf( moved.getLeft() )), 
+			"viewport entered and left cells are the differences", ihtype );
+	}
+}
+
+int main()
+{
+	testDefaultFillCoverage();
+	testFarIndices();
+	testOriginIndices();
+	testMaskBudget();
+	testInternKeys();
+	testStreamResume();
+	testOrderedPermutation();
+	testSeekAndTrim();
+	testStreamChunks();
+	testViewportUpdate();
+
+	if( failures > 0 ) {
+		cerr << failures << " failure(s)" << endl;
+		return 1;
+	}
+	cout << "All tests passed" << endl;
+	return 0;
+}